@@ -0,0 +1,16 @@
+@echo off
+
+call "C:\Program Files (x86)\Microsoft Visual Studio\2017\Community\VC\Auxiliary\Build\vcvarsall.bat" x64
+
+mkdir build
+pushd build
+
+SET ARGS=/MD /O2 /W4 /EHsc /arch:AVX
+
+SET LIBS=fmt.lib
+SET LIBPATHS=/LIBPATH:..\thirdparty\fmt\lib
+SET INCLUDES=/I ..\thirdparty\fmt\include /I ..\thirdparty\linmath\include
+
+cl /DNDEBUG %ARGS% %INCLUDES% ..\src\bench.cpp /link %LIBPATHS% %LIBS%
+
+popd
@@ -2,6 +2,12 @@
 
 call "C:\Program Files (x86)\Microsoft Visual Studio\2017\Community\VC\Auxiliary\Build\vcvarsall.bat" x64
 
+SET VULKAN_BIN=C:\VulkanSDK\1.2.141.2\Bin32
+
+:: debug_vert.spv is not checked in, build it from source and validate it.
+%VULKAN_BIN%\glslc.exe src\shaders\debug.vert -o data\shaders\debug_vert.spv || exit /b 1
+%VULKAN_BIN%\spirv-val.exe data\shaders\debug_vert.spv || exit /b 1
+
 mkdir build
 pushd build
 
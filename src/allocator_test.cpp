@@ -0,0 +1,284 @@
+#include <stdlib.h>
+#include <fmt/core.h>
+#include <vulkan/vulkan.h>
+
+struct GLFWwindow;
+
+#include "renderer/core.h"
+
+//  Checks the device memory suballocator against a real Vulkan device with
+//  no window or swapchain. Any implementation will do; on a machine without
+//  a GPU, point VK_ICD_FILENAMES at lavapipe's ICD.
+
+static uint32_t failures = 0;
+
+static void check(bool ok, const char *what)
+{
+    if (!ok) {
+        fmt::print("FAILED: {}\n", what);
+        failures++;
+    }
+}
+
+static bool create_headless_device(VkInstance *instance, VkPhysicalDevice *physical_device, VkDevice *device)
+{
+    VkApplicationInfo app_info = {};
+    app_info.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+    app_info.pApplicationName = "Allocator test";
+    app_info.apiVersion = VK_API_VERSION_1_0;
+
+    VkInstanceCreateInfo instance_info = {};
+    instance_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+    instance_info.pApplicationInfo = &app_info;
+
+    if (vkCreateInstance(&instance_info, nullptr, instance) != VK_SUCCESS) {
+        return false;
+    }
+
+    uint32_t count = 1;
+    VkResult result = vkEnumeratePhysicalDevices(*instance, &count, physical_device);
+
+    if ((result != VK_SUCCESS && result != VK_INCOMPLETE) || !count) {
+        vkDestroyInstance(*instance, nullptr);
+        return false;
+    }
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(*physical_device, &properties);
+    fmt::print("Device: {}\n", properties.deviceName);
+
+    float priority = 1.f;
+
+    VkDeviceQueueCreateInfo queue_info = {};
+    queue_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queue_info.queueFamilyIndex = 0;
+    queue_info.queueCount = 1;
+    queue_info.pQueuePriorities = &priority;
+
+    VkDeviceCreateInfo device_info = {};
+    device_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    device_info.queueCreateInfoCount = 1;
+    device_info.pQueueCreateInfos = &queue_info;
+
+    if (vkCreateDevice(*physical_device, &device_info, nullptr, device) != VK_SUCCESS) {
+        vkDestroyInstance(*instance, nullptr);
+        return false;
+    }
+
+    return true;
+}
+
+static VkMemoryRequirements requirements(VkDeviceSize size, VkDeviceSize alignment)
+{
+    VkMemoryRequirements r = {};
+    r.size = size;
+    r.alignment = alignment;
+    r.memoryTypeBits = ~0u;
+    return r;
+}
+
+const VkMemoryPropertyFlags HOST = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+const VkDeviceSize BLOCK = 1024 * 1024;
+
+static void test_alignment(Allocator *allocator)
+{
+    const VkDeviceSize alignments[] = {1, 4, 16, 256, 4096, 65536};
+    Allocation allocations[6];
+
+    for (size_t i = 0; i < 6; ++i) {
+        VkMemoryRequirements r = requirements(100 + i, alignments[i]);
+        check(allocator_alloc(allocator, &r, HOST, &allocations[i]), "alignment: alloc");
+        check(allocations[i].offset % alignments[i] == 0, "alignment: offset is a multiple of the alignment");
+        check(allocations[i].mapped != nullptr, "alignment: host visible memory is mapped");
+
+        memset(allocations[i].mapped, (int)i + 1, allocations[i].size);
+    }
+
+    // Nothing written through one mapping may have landed in another.
+    for (size_t i = 0; i < 6; ++i) {
+        unsigned char *data = (unsigned char *)allocations[i].mapped;
+        bool intact = true;
+
+        for (VkDeviceSize k = 0; k < allocations[i].size; ++k) {
+            intact = intact && data[k] == i + 1;
+        }
+
+        check(intact, "alignment: allocations don't overlap");
+    }
+
+    for (size_t i = 0; i < 6; ++i) {
+        allocator_free(allocator, &allocations[i]);
+    }
+}
+
+static void test_reuse(Allocator *allocator)
+{
+    VkMemoryRequirements r = requirements(4096, 256);
+    Allocation a, b;
+
+    check(allocator_alloc(allocator, &r, HOST, &a), "reuse: alloc");
+    VkDeviceMemory memory = a.memory;
+    VkDeviceSize offset = a.offset;
+    allocator_free(allocator, &a);
+
+    check(a.memory == VK_NULL_HANDLE, "reuse: free clears the allocation");
+    check(allocator_stats(allocator).blocks == 1, "reuse: the emptied block is kept");
+
+    for (int i = 0; i < 100; ++i) {
+        check(allocator_alloc(allocator, &r, HOST, &b), "reuse: alloc again");
+        check(b.memory == memory && b.offset == offset, "reuse: same block and offset come back");
+        allocator_free(allocator, &b);
+    }
+
+    // A second block that empties goes back to the driver.
+    Allocation big[3];
+    VkMemoryRequirements half = requirements(BLOCK / 2, 256);
+
+    for (size_t i = 0; i < 3; ++i) {
+        check(allocator_alloc(allocator, &half, HOST, &big[i]), "reuse: fill two blocks");
+    }
+
+    check(allocator_stats(allocator).blocks == 2, "reuse: second block created");
+
+    for (size_t i = 0; i < 3; ++i) {
+        allocator_free(allocator, &big[i]);
+    }
+
+    check(allocator_stats(allocator).blocks == 1, "reuse: only one empty block is kept");
+
+    // Over half a block gets a dedicated block, which is never kept.
+    VkMemoryRequirements large = requirements(BLOCK, 256);
+
+    check(allocator_alloc(allocator, &large, HOST, &a), "reuse: dedicated alloc");
+    check(a.offset == 0 && allocator_stats(allocator).blocks == 2, "reuse: dedicated block of its own");
+    allocator_free(allocator, &a);
+    check(allocator_stats(allocator).blocks == 1, "reuse: dedicated block freed");
+}
+
+static void test_coalescing(Allocator *allocator)
+{
+    const size_t COUNT = 8;
+    VkMemoryRequirements r = requirements(BLOCK / COUNT, 256);
+    Allocation a[COUNT];
+
+    for (size_t i = 0; i < COUNT; ++i) {
+        check(allocator_alloc(allocator, &r, HOST, &a[i]), "coalescing: alloc");
+    }
+
+    AllocatorStats stats = allocator_stats(allocator);
+    check(stats.allocations == COUNT && stats.used == BLOCK && stats.largest_free == 0, "coalescing: block is full");
+
+    allocator_free(allocator, &a[0]);
+    allocator_free(allocator, &a[2]);
+
+    stats = allocator_stats(allocator);
+    check(stats.largest_free == BLOCK / COUNT, "coalescing: separate holes stay separate");
+    check(stats.fragmentation > 0.49f && stats.fragmentation < 0.51f, "coalescing: two equal holes are half fragmented");
+
+    // Freeing the allocation between two holes merges all three.
+    allocator_free(allocator, &a[1]);
+
+    stats = allocator_stats(allocator);
+    check(stats.largest_free == 3 * BLOCK / COUNT, "coalescing: neighbours merged");
+    check(stats.fragmentation == 0.f, "coalescing: one hole");
+
+    r = requirements(3 * BLOCK / COUNT, 256);
+    Allocation merged;
+
+    check(allocator_alloc(allocator, &r, HOST, &merged), "coalescing: merged range is usable");
+    check(merged.memory == a[3].memory && merged.offset == 0, "coalescing: merged range starts at the front");
+    check(allocator_stats(allocator).blocks == 1, "coalescing: no new block");
+
+    allocator_free(allocator, &merged);
+
+    for (size_t i = 3; i < COUNT; ++i) {
+        allocator_free(allocator, &a[i]);
+    }
+}
+
+//  Random sizes and alignments, freed in random order, checked against
+//  the stats and for overlaps every thousand steps.
+static void test_random(Allocator *allocator)
+{
+    const size_t COUNT = 256;
+    Allocation allocations[COUNT] = {};
+    uint32_t state = 12345;
+
+    for (size_t step = 0; step < 20000; ++step) {
+        state = state * 1664525 + 1013904223;
+        size_t slot = (state >> 8) % COUNT;
+
+        if (allocations[slot].memory != VK_NULL_HANDLE) {
+            allocator_free(allocator, &allocations[slot]);
+        } else {
+            VkDeviceSize size = 1 + (state >> 16) % (BLOCK / 16);
+            VkDeviceSize alignment = VkDeviceSize(1) << ((state >> 4) % 13);
+            VkMemoryRequirements r = requirements(size, alignment);
+
+            check(allocator_alloc(allocator, &r, HOST, &allocations[slot]), "random: alloc");
+            check(allocations[slot].offset % alignment == 0, "random: aligned");
+        }
+
+        if (step % 1000) {
+            continue;
+        }
+
+        VkDeviceSize used = 0;
+        uint32_t live = 0;
+
+        for (size_t i = 0; i < COUNT; ++i) {
+            Allocation *x = &allocations[i];
+
+            if (x->memory == VK_NULL_HANDLE) {
+                continue;
+            }
+
+            used += x->size;
+            live++;
+
+            for (size_t k = i + 1; k < COUNT; ++k) {
+                Allocation *y = &allocations[k];
+
+                bool overlap = y->memory == x->memory && y->offset < x->offset + x->size && x->offset < y->offset + y->size;
+                check(!overlap, "random: allocations don't overlap");
+            }
+        }
+
+        AllocatorStats stats = allocator_stats(allocator);
+        check(stats.used == used && stats.allocations == live, "random: stats match the live allocations");
+    }
+
+    for (size_t i = 0; i < COUNT; ++i) {
+        allocator_free(allocator, &allocations[i]);
+    }
+
+    AllocatorStats stats = allocator_stats(allocator);
+    check(stats.allocations == 0 && stats.used == 0 && stats.blocks == 1, "random: everything freed, one block kept");
+}
+
+int main()
+{
+    VkInstance instance;
+    VkPhysicalDevice physical_device;
+    VkDevice device;
+
+    if (!create_headless_device(&instance, &physical_device, &device)) {
+        fmt::print("No Vulkan device.\n");
+        return 1;
+    }
+
+    Allocator allocator;
+    allocator_init(&allocator, physical_device, device, BLOCK);
+
+    test_alignment(&allocator);
+    test_reuse(&allocator);
+    test_coalescing(&allocator);
+    test_random(&allocator);
+
+    allocator_cleanup(&allocator);
+    vkDestroyDevice(device, nullptr);
+    vkDestroyInstance(instance, nullptr);
+
+    fmt::print("{}\n", failures ? "Allocator test FAILED." : "Allocator test passed.");
+    return failures ? 1 : 0;
+}
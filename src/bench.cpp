@@ -0,0 +1,1476 @@
+#include <stdlib.h>
+#include <chrono>
+#include <thread>
+#include <atomic>
+
+#include "octree/octree.h"
+#include "octree/compact.h"
+#include "octree/build.h"
+#include "octree/raycast.h"
+#include "octree/contour.h"
+#include "octree/edit.h"
+#include "octree/dag.h"
+#include "octree/file.h"
+#include "octree/paged.h"
+#include "octree/query.h"
+#include "octree/snapshot.h"
+#include "renderer/camera.h"
+#include "renderer/debug_lines.h"
+#include "math/math.h"
+
+static double now_seconds()
+{
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ull;
+
+static float random_float(float min, float max)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+
+    return min + (max - min) * (rng_state >> 40) / float(1 << 24);
+}
+
+// The six-plane intersect_cube that intersect_aabb replaced.
+static bool intersect_cube_reference(const vec3 l0, const vec3 l, vec3 min, vec3 max, float *tmin, float *tmax)
+{
+    intersect_plane(l0, l, min, vec3{1, 0, 0}, tmin);
+    intersect_plane(l0, l, max, vec3{-1, 0, 0}, tmax);
+
+    if (*tmin > *tmax) {
+        swapf(tmin, tmax);
+    }
+
+    float tymin,
+          tymax;
+
+    intersect_plane(l0, l, min, vec3{0, 1, 0}, &tymin);
+    intersect_plane(l0, l, max, vec3{0, -1, 0}, &tymax);
+
+    if (tymin > tymax) {
+        swapf(&tymin, &tymax);
+    }
+
+    if (*tmin > tymax || tymin > *tmax) {
+        return false;
+    }
+
+    if (tymin > *tmin) {
+        *tmin = tymin;
+    }
+
+    if (tymax < *tmax) {
+        *tmax = tymax;
+    }
+
+    float tzmin,
+          tzmax;
+
+    intersect_plane(l0, l, min, vec3{0, 0, 1}, &tzmin);
+    intersect_plane(l0, l, max, vec3{0, 0, -1}, &tzmax);
+
+    if (tzmin > tzmax) {
+        swapf(&tzmin, &tzmax);
+    }
+
+    if (*tmin > tzmax || tzmin > *tmax) {
+        return false;
+    }
+
+    if (tzmin > *tmin) {
+        *tmin = tzmin;
+    }
+
+    if (tzmax < *tmax) {
+        *tmax = tzmax;
+    }
+    
+    return true;
+}
+
+static vec3 * random_points(Octree::Octree *octree, size_t count)
+{
+    vec3 *points = new vec3[count];
+    float half = octree->size / 2;
+
+    for (size_t i = 0; i < count; ++i) {
+        for (size_t k = 0; k < 3; ++k) {
+            points[i][k] = octree->center[k] + random_float(-half, half);
+        }
+    }
+
+    return points;
+}
+
+//  Points along a random walk, so consecutive points are close together.
+static vec3 * coherent_points(Octree::Octree *octree, size_t count, float step)
+{
+    vec3 *points = new vec3[count];
+    float half = octree->size / 2;
+    vec3 p = {0, 0, 0};
+
+    for (size_t i = 0; i < count; ++i) {
+        for (size_t k = 0; k < 3; ++k) {
+            p[k] = std::min(half, std::max(-half, p[k] + random_float(-step, step)));
+            points[i][k] = octree->center[k] + p[k];
+        }
+    }
+
+    return points;
+}
+
+//  Points on a sphere around the octree center.
+static vec3 * sphere_points(Octree::Octree *octree, size_t count, float radius)
+{
+    vec3 *points = new vec3[count];
+
+    for (size_t i = 0; i < count; ++i) {
+        vec3 d;
+        do {
+            for (size_t k = 0; k < 3; ++k) {
+                d[k] = random_float(-1, 1);
+            }
+        } while (vec3_len(d) < 1e-3f || vec3_len(d) > 1);
+
+        vec3_scale(d, d, radius / vec3_len(d));
+        vec3_add(points[i], octree->center, d);
+    }
+
+    return points;
+}
+
+static float terrain_height(float x, float z)
+{
+    return 0.6f * sinf(1.3f * x) * cosf(1.1f * z) + 0.25f * sinf(3.7f * x + 1) * sinf(2.9f * z) - 0.5f;
+}
+
+//  Voxel centers of a heightfield shell at the resolution of `depth`. Every
+//  column reaches down to its lowest neighbour so the shell has no holes.
+static vec3 * terrain_points(Octree::Octree *octree, uint16_t depth, size_t *count)
+{
+    int32_t cells = 1 << depth;
+    float voxel = octree->size / cells;
+    float half = octree->size / 2;
+    int32_t *heights = new int32_t[cells * cells];
+
+    for (int32_t z = 0; z < cells; ++z) {
+        for (int32_t x = 0; x < cells; ++x) {
+            float h = terrain_height(octree->center[0] - half + (x + 0.5f) * voxel, octree->center[2] - half + (z + 0.5f) * voxel);
+            int32_t row = (int32_t)floorf((h - octree->center[1] + half) / voxel);
+            heights[z * cells + x] = std::min(cells - 1, std::max(0, row));
+        }
+    }
+
+    vec3 *points = nullptr;
+    size_t n = 0;
+
+    // Count the voxels first, then fill them in.
+    for (int pass = 0; pass < 2; ++pass) {
+        if (pass) {
+            points = new vec3[n];
+            n = 0;
+        }
+
+        for (int32_t z = 0; z < cells; ++z) {
+            for (int32_t x = 0; x < cells; ++x) {
+                int32_t top = heights[z * cells + x];
+                int32_t low = top;
+
+                low = std::min(low, heights[z * cells + std::max(x - 1, 0)]);
+                low = std::min(low, heights[z * cells + std::min(x + 1, cells - 1)]);
+                low = std::min(low, heights[std::max(z - 1, 0) * cells + x]);
+                low = std::min(low, heights[std::min(z + 1, cells - 1) * cells + x]);
+
+                for (int32_t y = low; y <= top; ++y, ++n) {
+                    if (pass) {
+                        points[n][0] = octree->center[0] - half + (x + 0.5f) * voxel;
+                        points[n][1] = octree->center[1] - half + (y + 0.5f) * voxel;
+                        points[n][2] = octree->center[2] - half + (z + 0.5f) * voxel;
+                    }
+                }
+            }
+        }
+    }
+
+    delete[] heights;
+    *count = n;
+    return points;
+}
+
+static void bench_insert_point(size_t count, uint16_t depth)
+{
+    Octree::Octree oct;
+    Octree::Init(&oct);
+
+    vec3 *points = random_points(&oct, count);
+
+    double start = now_seconds();
+    for (size_t i = 0; i < count; ++i) {
+        Octree::InsertPoint(&oct, 0, oct.center, points[i], 0, depth);
+    }
+    double elapsed = now_seconds() - start;
+
+    size_t nodes = (size_t)oct.used + 1;
+    fmt::print("InsertPoint: {} points, depth {}: {:.3f} s, {} nodes, {:.0f} nodes/s, {:.1f} bytes/node\n",
+        count, depth, elapsed, nodes, nodes / elapsed, (double)Octree::PoolBytes(&oct.nodes) / nodes);
+
+    delete[] points;
+    Octree::Cleanup(&oct);
+}
+
+//  Nodes whose children are all leaves. Each of them used to get a block
+//  of 8 nodes that was never read.
+static size_t count_leaf_parents(Octree::CompactOctree *octree, Octree::NodeIndex node)
+{
+    Octree::CompactNode *n = Octree::GetNode(octree, node);
+    uint8_t internal = n->child_mask & ~n->leaf_mask;
+
+    if (!internal) {
+        return n->child_mask ? 1 : 0;
+    }
+
+    size_t count = 0;
+    for (size_t i = 0; i < 8; ++i) {
+        if (internal & (1 << i)) {
+            count += count_leaf_parents(octree, n->first_child + i);
+        }
+    }
+
+    return count;
+}
+
+static void bench_node_layout(size_t count, uint16_t depth, size_t line_depth)
+{
+    Octree::Octree oct;
+    Octree::Init(&oct);
+
+    Octree::CompactOctree compact;
+    Octree::Init(&compact);
+
+    vec3 *points = random_points(&oct, count);
+
+    double start = now_seconds();
+    for (size_t i = 0; i < count; ++i) {
+        Octree::InsertPoint(&oct, 0, oct.center, points[i], 0, depth);
+    }
+    double insert = now_seconds() - start;
+
+    start = now_seconds();
+    for (size_t i = 0; i < count; ++i) {
+        Octree::InsertPoint(&compact, 0, compact.center, points[i], 0, depth);
+    }
+    double compact_insert = now_seconds() - start;
+
+    size_t len = 30 * ((size_t(8) << (3 * line_depth)) / 7);
+    vec3 *lines = new vec3[len];
+
+    size_t line_count = 0;
+    start = now_seconds();
+    Octree::DebugLineList(&oct, 0, oct.center, lines, len, 0, line_depth, &line_count);
+    double debug = now_seconds() - start;
+
+    size_t compact_line_count = 0;
+    start = now_seconds();
+    Octree::DebugLineList(&compact, 0, compact.center, lines, len, 0, line_depth, &compact_line_count);
+    double compact_debug = now_seconds() - start;
+
+    fmt::print("OctreeNode:  {} bytes/node, InsertPoint {:.3f} s, DebugLineList {:.3f} s ({} verts)\n",
+        sizeof(Octree::OctreeNode), insert, debug, line_count);
+    fmt::print("CompactNode: {} bytes/node, InsertPoint {:.3f} s, DebugLineList {:.3f} s ({} verts)\n",
+        sizeof(Octree::CompactNode), compact_insert, compact_debug, compact_line_count);
+
+    if (line_count != compact_line_count) {
+        fmt::print("DebugLineList: the layouts drew different lines, the times don't compare\n");
+    }
+
+    size_t compact_bytes = (size_t)compact.used * sizeof(Octree::CompactNode);
+    size_t eager_bytes = compact_bytes + 8 * count_leaf_parents(&compact, 0) * sizeof(Octree::CompactNode);
+
+    fmt::print("CompactNode: {:.1f} MB used, {:.1f} MB with a block under every leaf parent, OctreeNode {:.1f} MB\n",
+        compact_bytes / 1e6, eager_bytes / 1e6, ((size_t)oct.used + 1) * sizeof(Octree::OctreeNode) / 1e6);
+
+    delete[] lines;
+    delete[] points;
+    Octree::Cleanup(&oct);
+    Octree::Cleanup(&compact);
+}
+
+static void bench_build_from_points(size_t count, uint16_t depth)
+{
+    Octree::Octree oct;
+    Octree::Init(&oct);
+
+    vec3 *points = random_points(&oct, count);
+
+    double start = now_seconds();
+    for (size_t i = 0; i < count; ++i) {
+        Octree::InsertPoint(&oct, 0, oct.center, points[i], 0, depth);
+    }
+    double insert = now_seconds() - start;
+    size_t insert_nodes = (size_t)oct.used + 1;
+
+    start = now_seconds();
+    Octree::BuildFromPoints(&oct, points, count, depth);
+    double build = now_seconds() - start;
+    size_t build_nodes = (size_t)oct.used + 1;
+
+    fmt::print("InsertPoint:     {:.3f} s, {:.0f} points/s, {} nodes\n", insert, count / insert, insert_nodes);
+    fmt::print("BuildFromPoints: {:.3f} s, {:.0f} points/s, {} nodes, {:.1f}x\n", build, count / build, build_nodes, insert / build);
+
+    delete[] points;
+    Octree::Cleanup(&oct);
+}
+
+static void bench_build_parallel(size_t count, uint16_t depth)
+{
+    Octree::Octree oct;
+    Octree::Init(&oct);
+
+    vec3 *points = random_points(&oct, count);
+
+    // Warm the node pool up so both builds start from the same capacity.
+    Octree::BuildFromPoints(&oct, points, count, depth);
+
+    double start = now_seconds();
+    Octree::BuildFromPoints(&oct, points, count, depth);
+    double serial = now_seconds() - start;
+    size_t serial_nodes = (size_t)oct.used + 1;
+
+    fmt::print("BuildFromPoints:         {:.3f} s, {} nodes\n", serial, serial_nodes);
+
+    uint32_t cores = std::max(1u, std::thread::hardware_concurrency());
+    for (uint32_t threads = 1;; threads = std::min(threads * 2, cores)) {
+        start = now_seconds();
+        Octree::BuildFromPointsParallel(&oct, points, count, depth, threads);
+        double parallel = now_seconds() - start;
+
+        fmt::print("BuildFromPointsParallel: {:2} threads {:.3f} s, {} nodes, {:.1f}x\n",
+            threads, parallel, (size_t)oct.used + 1, serial / parallel);
+
+        if (threads == cores) {
+            break;
+        }
+    }
+
+    delete[] points;
+    Octree::Cleanup(&oct);
+}
+
+static void bench_insert_latency(size_t count, uint16_t depth)
+{
+    Octree::Octree oct;
+    Octree::Init(&oct);
+
+    vec3 *points = random_points(&oct, count);
+    vec3 *coherent = coherent_points(&oct, count, oct.size / (2 << depth));
+
+    double start = now_seconds();
+    for (size_t i = 0; i < count; ++i) {
+        Octree::InsertPoint(&oct, 0, oct.center, points[i], 0, depth);
+    }
+    double single = now_seconds() - start;
+
+    Octree::Clear(&oct);
+    start = now_seconds();
+    Octree::InsertPoints(&oct, points, count, depth);
+    double batch = now_seconds() - start;
+
+    Octree::Clear(&oct);
+    start = now_seconds();
+    for (size_t i = 0; i < count; ++i) {
+        Octree::InsertPoint(&oct, 0, oct.center, coherent[i], 0, depth);
+    }
+    double coherent_single = now_seconds() - start;
+
+    Octree::Clear(&oct);
+    start = now_seconds();
+    Octree::InsertPoints(&oct, coherent, count, depth);
+    double coherent_batch = now_seconds() - start;
+
+    fmt::print("InsertPoint  random:   {:.1f} ns/insert\n", single * 1e9 / count);
+    fmt::print("InsertPoints random:   {:.1f} ns/insert\n", batch * 1e9 / count);
+    fmt::print("InsertPoint  coherent: {:.1f} ns/insert\n", coherent_single * 1e9 / count);
+    fmt::print("InsertPoints coherent: {:.1f} ns/insert\n", coherent_batch * 1e9 / count);
+
+    delete[] coherent;
+    delete[] points;
+    Octree::Cleanup(&oct);
+}
+
+static void bench_raycast(size_t count, uint16_t depth, size_t rays)
+{
+    Octree::Octree oct;
+    Octree::Init(&oct);
+
+    vec3 *points = sphere_points(&oct, count, oct.size * 0.4f);
+    Octree::BuildFromPoints(&oct, points, count, depth);
+
+    // Primary rays of a camera looking at the center, in scanline order.
+    vec3 *origins = new vec3[rays];
+    vec3 *dirs = new vec3[rays];
+    size_t width = (size_t)sqrt((double)rays);
+
+    for (size_t i = 0; i < rays; ++i) {
+        vec3 target = {
+            oct.center[0] + oct.size * ((i % width) / (float)width - 0.5f),
+            oct.center[1] + oct.size * ((i / width) / (float)width - 0.5f),
+            oct.center[2]
+        };
+
+        memcpy(origins[i], oct.center, sizeof(vec3));
+        origins[i][2] += oct.size * 1.5f;
+
+        vec3_sub(dirs[i], target, origins[i]);
+        vec3_norm(dirs[i], dirs[i]);
+    }
+
+    size_t hits = 0;
+    double start = now_seconds();
+    for (size_t i = 0; i < rays; ++i) {
+        Octree::RayHit hit;
+        hits += Octree::RayCast(&oct, origins[i], dirs[i], &hit);
+    }
+    double elapsed = now_seconds() - start;
+
+    fmt::print("RayCast: depth {}, {} nodes, {} rays, {} hits, {:.2f} Mrays/s\n",
+        depth, (size_t)oct.used + 1, rays, hits, rays / elapsed * 1e-6);
+
+    delete[] dirs;
+    delete[] origins;
+    delete[] points;
+    Octree::Cleanup(&oct);
+}
+
+static int count_bits(int mask)
+{
+    int count = 0;
+    for (; mask; mask &= mask - 1) {
+        ++count;
+    }
+
+    return count;
+}
+
+static void bench_slab(size_t rays, size_t repeat)
+{
+    vec3 *origins = new vec3[rays];
+    vec3 *dirs = new vec3[rays];
+    vec3 *invs = new vec3[rays];
+
+    for (size_t i = 0; i < rays; ++i) {
+        for (size_t k = 0; k < 3; ++k) {
+            origins[i][k] = random_float(-4, 4);
+            dirs[i][k] = random_float(-1, 1);
+        }
+
+        vec3_norm(dirs[i], dirs[i]);
+        ray_inverse(invs[i], dirs[i]);
+    }
+
+    vec3 min = {-1, -1, -1};
+    vec3 max = {1, 1, 1};
+    size_t tests = rays * repeat;
+    size_t hits = 0;
+    float tmin, tmax;
+
+    double start = now_seconds();
+    for (size_t r = 0; r < repeat; ++r) {
+        for (size_t i = 0; i < rays; ++i) {
+            hits += intersect_cube_reference(origins[i], dirs[i], min, max, &tmin, &tmax);
+        }
+    }
+    fmt::print("intersect_cube (planes): {:.2f} ns/test, {} hits\n", (now_seconds() - start) * 1e9 / tests, hits);
+
+    hits = 0;
+    start = now_seconds();
+    for (size_t r = 0; r < repeat; ++r) {
+        for (size_t i = 0; i < rays; ++i) {
+            hits += intersect_aabb(origins[i], invs[i], min, max, &tmin, &tmax);
+        }
+    }
+    fmt::print("intersect_aabb:          {:.2f} ns/test, {} hits\n", (now_seconds() - start) * 1e9 / tests, hits);
+
+    size_t packets = rays / 8;
+    RayPacket4 *packets4 = (RayPacket4 *)_mm_malloc(sizeof(RayPacket4) * packets * 2, 32);
+    AABB4 boxes4;
+    float tmin4[8], tmax4[8];
+
+    for (size_t i = 0; i < packets * 2; ++i) {
+        float v[6][4];
+        for (size_t j = 0; j < 4; ++j) {
+            for (size_t k = 0; k < 3; ++k) {
+                v[k][j] = origins[i * 4 + j][k];
+                v[k + 3][j] = invs[i * 4 + j][k];
+            }
+        }
+
+        packets4[i] = {_mm_loadu_ps(v[0]), _mm_loadu_ps(v[1]), _mm_loadu_ps(v[2]),
+            _mm_loadu_ps(v[3]), _mm_loadu_ps(v[4]), _mm_loadu_ps(v[5])};
+    }
+
+    boxes4 = {_mm_set1_ps(-1), _mm_set1_ps(-1), _mm_set1_ps(-1), _mm_set1_ps(1), _mm_set1_ps(1), _mm_set1_ps(1)};
+
+    hits = 0;
+    start = now_seconds();
+    for (size_t r = 0; r < repeat; ++r) {
+        for (size_t i = 0; i < packets * 2; ++i) {
+            hits += count_bits(intersect_aabb_rays4(&packets4[i], min, max, tmin4, tmax4));
+        }
+    }
+    fmt::print("intersect_aabb_rays4:    {:.2f} ns/test, {} hits\n", (now_seconds() - start) * 1e9 / (packets * 8 * repeat), hits);
+
+    hits = 0;
+    start = now_seconds();
+    for (size_t r = 0; r < repeat; ++r) {
+        for (size_t i = 0; i < packets * 2; ++i) {
+            hits += count_bits(intersect_aabb4(origins[i], invs[i], &boxes4, tmin4, tmax4));
+        }
+    }
+    fmt::print("intersect_aabb4:         {:.2f} ns/test\n", (now_seconds() - start) * 1e9 / (packets * 8 * repeat));
+
+#ifdef __AVX__
+    RayPacket8 *packets8 = (RayPacket8 *)_mm_malloc(sizeof(RayPacket8) * packets, 32);
+    AABB8 boxes8 = {_mm256_set1_ps(-1), _mm256_set1_ps(-1), _mm256_set1_ps(-1), _mm256_set1_ps(1), _mm256_set1_ps(1), _mm256_set1_ps(1)};
+
+    for (size_t i = 0; i < packets; ++i) {
+        packets8[i] = {
+            _mm256_set_m128(packets4[2 * i + 1].ox, packets4[2 * i].ox),
+            _mm256_set_m128(packets4[2 * i + 1].oy, packets4[2 * i].oy),
+            _mm256_set_m128(packets4[2 * i + 1].oz, packets4[2 * i].oz),
+            _mm256_set_m128(packets4[2 * i + 1].ix, packets4[2 * i].ix),
+            _mm256_set_m128(packets4[2 * i + 1].iy, packets4[2 * i].iy),
+            _mm256_set_m128(packets4[2 * i + 1].iz, packets4[2 * i].iz)
+        };
+    }
+
+    hits = 0;
+    start = now_seconds();
+    for (size_t r = 0; r < repeat; ++r) {
+        for (size_t i = 0; i < packets; ++i) {
+            hits += count_bits(intersect_aabb_rays8(&packets8[i], min, max, tmin4, tmax4));
+        }
+    }
+    fmt::print("intersect_aabb_rays8:    {:.2f} ns/test, {} hits\n", (now_seconds() - start) * 1e9 / (packets * 8 * repeat), hits);
+
+    hits = 0;
+    start = now_seconds();
+    for (size_t r = 0; r < repeat; ++r) {
+        for (size_t i = 0; i < packets; ++i) {
+            hits += count_bits(intersect_aabb8(origins[i], invs[i], &boxes8, tmin4, tmax4));
+        }
+    }
+    fmt::print("intersect_aabb8:         {:.2f} ns/test\n", (now_seconds() - start) * 1e9 / (packets * 8 * repeat));
+
+    _mm_free(packets8);
+#endif
+
+    _mm_free(packets4);
+    delete[] invs;
+    delete[] dirs;
+    delete[] origins;
+}
+
+static size_t count_nodes(Octree::Octree *octree, Octree::NodeIndex node)
+{
+    size_t count = 1;
+
+    if (Octree::HasChildren(octree, node)) {
+        for (size_t i = 0; i < 8; ++i) {
+            count += count_nodes(octree, Octree::GetNode(octree, node)->children[i]);
+        }
+    }
+
+    return count;
+}
+
+static void count_dirty(Octree::Octree *octree, Octree::NodeIndex node, const vec3, uint16_t, void *user)
+{
+    *(size_t *)user += count_nodes(octree, node);
+}
+
+//  Cost of finding what changed after a handful of inserts, against walking
+//  the whole tree.
+static void bench_dirty(size_t count, uint16_t depth, size_t edits)
+{
+    Octree::Octree oct;
+    Octree::Init(&oct);
+
+    vec3 *points = random_points(&oct, count);
+    Octree::BuildFromPoints(&oct, points, count, depth);
+
+    size_t visited = 0;
+    Octree::VisitDirty(&oct, count_dirty, &visited);
+
+    double start = now_seconds();
+    size_t nodes = count_nodes(&oct, 0);
+    double full = now_seconds() - start;
+
+    const size_t FRAMES = 1000;
+    vec3 *edit_points = random_points(&oct, edits * FRAMES);
+    double visit = 0;
+    visited = 0;
+
+    for (size_t frame = 0; frame < FRAMES; ++frame) {
+        for (size_t i = 0; i < edits; ++i) {
+            Octree::InsertPoint(&oct, 0, oct.center, edit_points[frame * edits + i], 0, depth + 2);
+        }
+
+        start = now_seconds();
+        Octree::VisitDirty(&oct, count_dirty, &visited);
+        visit += now_seconds() - start;
+    }
+
+    fmt::print("VisitDirty: {} edits/frame, {:.1f} us/frame, {:.0f} nodes/frame; full walk {:.1f} ms, {} nodes\n",
+        edits, visit * 1e6 / FRAMES, (double)visited / FRAMES, full * 1e3, nodes);
+
+    delete[] edit_points;
+    delete[] points;
+    Octree::Cleanup(&oct);
+}
+
+//  A long editing session: every round inserts a batch of points and
+//  removes another. With freed nodes recycled, the pool stops growing once
+//  the tree reaches its working size.
+static void bench_edit(size_t count, uint16_t depth, size_t rounds)
+{
+    Octree::Octree oct;
+    Octree::Init(&oct);
+
+    vec3 *points = random_points(&oct, count * rounds);
+    double insert = 0, remove = 0;
+
+    for (size_t round = 0; round < rounds; ++round) {
+        double start = now_seconds();
+        Octree::InsertPoints(&oct, &points[round * count], count, depth);
+        insert += now_seconds() - start;
+
+        if (!round) {
+            continue;
+        }
+
+        start = now_seconds();
+        for (size_t i = 0; i < count; ++i) {
+            Octree::RemovePoint(&oct, points[(round - 1) * count + i], depth);
+        }
+        remove += now_seconds() - start;
+
+        if (round == 1 || round + 1 == rounds) {
+            fmt::print("Edit: round {}, {} nodes allocated, {} free, {} live\n",
+                round, (size_t)oct.used + 1, (size_t)oct.free_count, count_nodes(&oct, 0));
+        }
+    }
+
+    fmt::print("Edit: {} rounds of {} points, InsertPoints {:.0f} ns/point, RemovePoint {:.0f} ns/point\n",
+        rounds, count, insert * 1e9 / (count * rounds), remove * 1e9 / (count * (rounds - 1)));
+
+    Octree::Clear(&oct);
+    Octree::InsertPoints(&oct, points, count * rounds, depth);
+    size_t before = count_nodes(&oct, 0);
+
+    double start = now_seconds();
+    Octree::Collapse(&oct);
+    double collapse = now_seconds() - start;
+
+    fmt::print("Edit: Collapse {:.1f} ms, {} nodes down to {}\n", collapse * 1e3, before, count_nodes(&oct, 0));
+
+    delete[] points;
+    Octree::Cleanup(&oct);
+}
+
+struct LeafList {
+    Octree::NodeIndex *nodes;
+    vec3 *centers;
+    size_t count;
+    size_t capacity;
+};
+
+static void collect_leaves(Octree::Octree *octree, Octree::NodeIndex node, const vec3 center, uint16_t depth, uint16_t max_depth, LeafList *list)
+{
+    if (depth == max_depth) {
+        if (list->count < list->capacity) {
+            list->nodes[list->count] = node;
+            memcpy(list->centers[list->count++], center, sizeof(vec3));
+        }
+
+        return;
+    }
+
+    if (!Octree::HasChildren(octree, node)) {
+        return;
+    }
+
+    for (size_t i = 0; i < 8; ++i) {
+        vec3 c;
+        vec3_scale(c, Octree::CHILDREN_CENTER_OFFSET[i], octree->size / (2 << depth));
+        vec3_add(c, center, c);
+
+        collect_leaves(octree, Octree::GetNode(octree, node)->children[i], c, depth + 1, max_depth, list);
+    }
+}
+
+//  Deepest node down to max_depth holding p, walking from the root.
+static Octree::NodeIndex find_node(Octree::Octree *octree, const vec3 p, uint16_t max_depth)
+{
+    float half = octree->size / 2;
+    for (size_t k = 0; k < 3; ++k) {
+        if (p[k] < octree->center[k] - half || p[k] > octree->center[k] + half) {
+            return 0;
+        }
+    }
+
+    Octree::NodeIndex node = 0;
+    vec3 c;
+    memcpy(c, octree->center, sizeof(vec3));
+
+    for (uint16_t depth = 0; depth < max_depth && Octree::HasChildren(octree, node); ++depth) {
+        uint32_t i = Octree::ChildIndex(c, p);
+
+        vec3 offset;
+        vec3_scale(offset, Octree::CHILDREN_CENTER_OFFSET[i], octree->size / (2 << depth));
+        vec3_add(c, c, offset);
+
+        node = Octree::GetNode(octree, node)->children[i];
+    }
+
+    return node;
+}
+
+//  All 26 neighbours of deepest level leaves, through parent links and by
+//  descending from the root to a point in each neighbour.
+static void bench_neighbours(size_t count, uint16_t depth, size_t leaves)
+{
+    Octree::Octree oct;
+    Octree::Init(&oct);
+
+    float voxel = oct.size / (1 << depth);
+    vec3 *points = coherent_points(&oct, count, voxel);
+    Octree::InsertPoints(&oct, points, count, depth);
+
+    LeafList list = {new Octree::NodeIndex[leaves], new vec3[leaves], 0, leaves};
+    collect_leaves(&oct, 0, oct.center, 0, depth, &list);
+
+    size_t found = 0;
+    double start = now_seconds();
+    for (size_t i = 0; i < list.count; ++i) {
+        for (int dz = -1; dz <= 1; ++dz) {
+            for (int dy = -1; dy <= 1; ++dy) {
+                for (int dx = -1; dx <= 1; ++dx) {
+                    if (dx || dy || dz) {
+                        found += Octree::FindNeighbour(&oct, list.nodes[i], dx, dy, dz) != 0;
+                    }
+                }
+            }
+        }
+    }
+    double linked = now_seconds() - start;
+
+    size_t naive_found = 0;
+    start = now_seconds();
+    for (size_t i = 0; i < list.count; ++i) {
+        for (int dz = -1; dz <= 1; ++dz) {
+            for (int dy = -1; dy <= 1; ++dy) {
+                for (int dx = -1; dx <= 1; ++dx) {
+                    if (dx || dy || dz) {
+                        vec3 p = {list.centers[i][0] + dx * voxel, list.centers[i][1] + dy * voxel, list.centers[i][2] + dz * voxel};
+                        naive_found += find_node(&oct, p, depth) != 0;
+                    }
+                }
+            }
+        }
+    }
+    double naive = now_seconds() - start;
+
+    size_t lookups = 26 * list.count;
+    fmt::print("FindNeighbour: depth {}, {} leaves, {:.1f} ns/lookup ({} found); from the root {:.1f} ns/lookup ({} found)\n",
+        depth, list.count, linked * 1e9 / lookups, found, naive * 1e9 / lookups, naive_found);
+
+    delete[] list.centers;
+    delete[] list.nodes;
+    delete[] points;
+    Octree::Cleanup(&oct);
+}
+
+static float sphere_distance(const vec3 p, void *user)
+{
+    Octree::Octree *octree = (Octree::Octree *)user;
+    vec3 d;
+    vec3_sub(d, p, octree->center);
+    return vec3_len(d) - octree->size * 0.4f;
+}
+
+static void bench_contour(size_t count, uint16_t depth)
+{
+    Octree::Octree oct;
+    Octree::Init(&oct);
+
+    vec3 *points = sphere_points(&oct, count, oct.size * 0.4f);
+    Octree::BuildFromPoints(&oct, points, count, depth);
+
+    double start = now_seconds();
+    Octree::SampleHermite(&oct, sphere_distance, &oct);
+    double sample = now_seconds() - start;
+
+    Octree::Mesh mesh;
+    Octree::MeshInit(&mesh);
+
+    // The first run grows the mesh arrays, the second reuses them.
+    start = now_seconds();
+    Octree::Contour(&oct, &mesh);
+    double first = now_seconds() - start;
+
+    start = now_seconds();
+    Octree::Contour(&oct, &mesh);
+    double contour = now_seconds() - start;
+
+    fmt::print("Contour: depth {}, {} nodes, {} leaves with data, SampleHermite {:.3f} s\n",
+        depth, (size_t)oct.used + 1, (size_t)oct.hermite_used, sample);
+    fmt::print("Contour: {} verts, {} tris, {:.3f} s first, {:.3f} s reused, {:.1f} Mtris/s\n",
+        mesh.vertex_count, mesh.index_count / 3, first, contour, mesh.index_count / 3 / contour * 1e-6);
+
+    Octree::MeshCleanup(&mesh);
+    delete[] points;
+    Octree::Cleanup(&oct);
+}
+
+static double time_brush(Octree::Octree *octree, const Octree::Brush *brush, uint16_t depth)
+{
+    double start = now_seconds();
+    Octree::ApplyBrush(octree, brush, depth);
+    return now_seconds() - start;
+}
+
+//  Brush edits around 80 voxels in radius, so each one crosses about 100k
+//  voxels of surface: a sphere, a capsule cut through it and a painted box.
+static void bench_brush(uint16_t depth)
+{
+    Octree::Octree oct;
+    Octree::Init(&oct);
+
+    float voxel = oct.size / (1 << depth);
+    float radius = 80 * voxel;
+
+    Octree::Brush sphere = {Octree::BRUSH_SPHERE, Octree::BRUSH_ADD, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, radius, 0xffff};
+    double add = time_brush(&oct, &sphere, depth);
+    size_t surface = (size_t)oct.hermite_used;
+
+    Octree::Brush capsule = {Octree::BRUSH_CAPSULE, Octree::BRUSH_SUBTRACT, {-radius, 0, 0}, {radius, 0, 0}, {0, 0, 0}, radius / 2, 0};
+    double subtract = time_brush(&oct, &capsule, depth);
+
+    Octree::Brush box = {Octree::BRUSH_BOX, Octree::BRUSH_PAINT, {0, radius, 0}, {0, 0, 0}, {radius, radius / 2, radius}, 0, 2};
+    double paint = time_brush(&oct, &box, depth);
+
+    // Adding a different material over solid space replaces it.
+    Octree::Brush recolor = {Octree::BRUSH_SPHERE, Octree::BRUSH_ADD, {0, -radius * 0.75f, 0}, {0, 0, 0}, {0, 0, 0}, radius / 8, 3};
+    time_brush(&oct, &recolor, depth);
+    Octree::NodeValue recolored = Octree::GetNode(&oct, find_node(&oct, recolor.a, depth))->value;
+
+    Octree::Mesh mesh;
+    Octree::MeshInit(&mesh);
+    Octree::Contour(&oct, &mesh);
+
+    fmt::print("ApplyBrush: depth {}, {} surface voxels, add {:.2f} ms, subtract {:.2f} ms, paint {:.2f} ms\n",
+        depth, surface, add * 1e3, subtract * 1e3, paint * 1e3);
+    fmt::print("ApplyBrush: {} nodes, {} leaves with data, {} tris, add over solid gives value {}\n",
+        (size_t)(oct.used - oct.free_count) + 1, (size_t)oct.hermite_used, mesh.index_count / 3, recolored);
+
+    // The first edits again through an EditQueue, spread over frames of
+    // EDIT_BUDGET nodes each on a copy of the tree. The second and third
+    // are submitted while the first is still running.
+    const size_t EDIT_BUDGET = 16384;
+
+    Octree::Octree trees[2];
+    Octree::Init(&trees[0]);
+    Octree::Init(&trees[1]);
+
+    Octree::EditQueue edits;
+    Octree::EditQueueInit(&edits, &trees[0], &trees[1]);
+    Octree::SubmitBrush(&edits, &sphere, depth);
+
+    size_t frames = 0;
+    size_t published = 0;
+    double longest = 0;
+    bool whole = true;
+    Octree::Octree *shown = edits.shown;
+
+    for (; edits.editing || edits.count || frames == 0; ++frames) {
+        if (frames == 1) {
+            Octree::SubmitBrush(&edits, &capsule, depth);
+            Octree::SubmitBrush(&edits, &box, depth);
+        }
+
+        uint32_t generation = shown->generation;
+
+        double start = now_seconds();
+        Octree::Octree *next = Octree::UpdateEdits(&edits, EDIT_BUDGET);
+        double elapsed = now_seconds() - start;
+
+        longest = elapsed > longest ? elapsed : longest;
+
+        // What readers see only changes when an edit is published.
+        if (next == shown) {
+            whole = whole && shown->generation == generation;
+        } else {
+            published++;
+        }
+
+        shown = next;
+    }
+
+    // The same three edits applied at once, node for node.
+    Octree::Octree copy;
+    Octree::Init(&copy);
+    Octree::ApplyBrush(&copy, &sphere, depth);
+    Octree::ApplyBrush(&copy, &capsule, depth);
+    Octree::ApplyBrush(&copy, &box, depth);
+
+    Octree::Octree *result = edits.shown;
+    bool same = result->used == copy.used && result->hermite_used == copy.hermite_used;
+
+    for (Octree::NodeIndex i = 0; same && i <= copy.used; ++i) {
+        same = !memcmp(Octree::GetNode(result, i), Octree::GetNode(&copy, i), sizeof(Octree::OctreeNode));
+    }
+
+    fmt::print("EditQueue: {} edits published over {} frames of {} nodes, longest {:.2f} ms, {}, {}\n",
+        published, frames, EDIT_BUDGET, longest * 1e3,
+        whole ? "never half applied" : "HALF APPLIED EDIT SEEN",
+        same ? "same tree as ApplyBrush" : "DIFFERS from ApplyBrush");
+
+    Octree::EditQueueCleanup(&edits);
+    Octree::MeshCleanup(&mesh);
+    Octree::Cleanup(&oct);
+    Octree::Cleanup(&trees[0]);
+    Octree::Cleanup(&trees[1]);
+    Octree::Cleanup(&copy);
+}
+
+static void count_leaf(const vec3, float, Octree::NodeValue, void *user)
+{
+    *(size_t *)user += 1;
+}
+
+static size_t count_leaves(Octree::Octree *octree, Octree::NodeIndex node)
+{
+    if (!Octree::HasChildren(octree, node)) {
+        return Octree::GetNode(octree, node)->value != 0;
+    }
+
+    size_t count = 0;
+    for (size_t i = 0; i < 8; ++i) {
+        count += count_leaves(octree, Octree::GetNode(octree, node)->children[i]);
+    }
+
+    return count;
+}
+
+//  Latency of the spatial queries: boxes a few voxels wide and the nearest
+//  one and eight leaves around random points.
+static void bench_queries(size_t count, uint16_t depth, size_t queries)
+{
+    Octree::Octree oct;
+    Octree::Init(&oct);
+
+    vec3 *points = random_points(&oct, count);
+    Octree::BuildFromPoints(&oct, points, count, depth);
+
+    float voxel = oct.size / (1 << depth);
+    vec3 *centers = random_points(&oct, queries);
+
+    size_t found = 0;
+    double start = now_seconds();
+    for (size_t i = 0; i < queries; ++i) {
+        vec3 min, max;
+        for (size_t k = 0; k < 3; ++k) {
+            min[k] = centers[i][k] - 4 * voxel;
+            max[k] = centers[i][k] + 4 * voxel;
+        }
+
+        Octree::QueryBox(&oct, min, max, count_leaf, &found);
+    }
+    double box = now_seconds() - start;
+
+    fmt::print("QueryBox: depth {}, 8 voxel boxes, {:.2f} us/query, {:.1f} leaves/query\n",
+        depth, box * 1e6 / queries, (double)found / queries);
+
+    for (uint32_t k : {1u, 8u}) {
+        Octree::NearestHit hits[Octree::NEAREST_MAX];
+        double distance = 0;
+
+        start = now_seconds();
+        for (size_t i = 0; i < queries; ++i) {
+            uint32_t n = Octree::QueryNearest(&oct, centers[i], k, hits);
+            distance += n ? hits[n - 1].distance : 0;
+        }
+        double nearest = now_seconds() - start;
+
+        fmt::print("QueryNearest: k = {}, {:.2f} us/query, {:.2f} voxels to the farthest\n",
+            k, nearest * 1e6 / queries, distance / voxel / queries);
+    }
+
+    delete[] centers;
+    delete[] points;
+    Octree::Cleanup(&oct);
+}
+
+//  Wireframe of a deep terrain from a camera above one of its corners, all
+//  of it against only what is on screen and at least 4 pixels wide.
+static void bench_debug_view(uint16_t depth)
+{
+    Octree::Octree oct;
+    Octree::Init(&oct);
+
+    size_t count;
+    vec3 *points = terrain_points(&oct, depth, &count);
+    Octree::BuildFromPoints(&oct, points, count, depth);
+
+    size_t len = 30 * ((size_t)oct.used / 8 + 1);
+    vec3 *lines = new vec3[len];
+
+    size_t full_count = 0;
+    double start = now_seconds();
+    Octree::DebugLineList(&oct, 0, oct.center, lines, len, 0, depth, &full_count);
+    double full = now_seconds() - start;
+
+    FPSCamera camera;
+    create_fpscamera(&camera, to_radians(90.f), 4.f / 3.f, .01f, 1000.f);
+
+    mat4x4 proj, look, view_proj;
+    mat4x4_perspective(proj, camera.fov, camera.aspect, camera.near, camera.far);
+    mat4x4_look_at(look, vec3{-1.5f, 0.5f, -1.5f}, vec3{0, -0.5f, 0}, vec3{0, 1, 0});
+    mat4x4_mul(view_proj, proj, look);
+
+    Octree::DebugView view;
+    Octree::DebugViewInit(&view, view_proj, fpscamera_pixel_scale(&camera, 600), 4.f);
+
+    size_t view_count = 0;
+    start = now_seconds();
+    Octree::DebugLineList(&oct, 0, oct.center, lines, len, 0, depth, &view_count, &view);
+    double culled = now_seconds() - start;
+
+    fmt::print("DebugLineList: terrain depth {}, whole tree {:.2f} ms ({} verts), culled with LOD {:.2f} ms ({} verts)\n",
+        depth, full * 1e3, full_count, culled * 1e3, view_count);
+
+    delete[] lines;
+    delete[] points;
+    Octree::Cleanup(&oct);
+}
+
+//  `lines` debug lines a frame for `frames` frames, timing the drawing and
+//  the copy out of the chunks that the flush does into its ring buffer,
+//  here plain host memory. The first frame grows the chunk chain, so it is
+//  reported apart from the steady frames after it.
+static void bench_debug_lines(uint32_t lines, size_t frames)
+{
+    DebugRenderer debug;
+    debug_renderer_init_chunks(&debug);
+
+    vec3 *ring = new vec3[(size_t)lines * 2];
+    double first_draw = 0, draw = 0, copy = 0;
+
+    for (size_t frame = 0; frame < frames; ++frame) {
+        double start = now_seconds();
+
+        for (uint32_t i = 0; i < lines; ++i) {
+            float x = (i & 4095) / 1024.f - 2.f;
+            float y = (i >> 12) / 1024.f - 2.f;
+
+            vec3 a = {x, y, 0};
+            vec3 b = {x, y, .01f};
+            debug_renderer_drawline(&debug, a, b);
+        }
+
+        double drawn = now_seconds();
+        size_t offset = 0;
+
+        for (uint32_t i = 0; i <= debug.chunk; ++i) {
+            uint32_t count = debug_renderer_chunk_size(&debug, i);
+            memcpy(ring + offset, debug.chunks[i], count * sizeof(vec3));
+            offset += count;
+        }
+
+        debug_renderer_reset(&debug);
+        double copied = now_seconds();
+
+        if (frame) {
+            draw += drawn - start;
+            copy += copied - drawn;
+        } else {
+            first_draw = drawn - start;
+        }
+    }
+
+    double steady = (double)lines * (frames - 1);
+
+    fmt::print("DebugRenderer: {} lines, first frame {:.2f} ns/line drawing, then {:.2f} ns/line drawing, {:.2f} ns/line copying, {} chunks\n",
+        lines, 1e9 * first_draw / lines, 1e9 * draw / steady, 1e9 * copy / steady, debug.chunk_count);
+
+    delete[] ring;
+    debug_renderer_cleanup(&debug);
+}
+
+//  Full volume of a snapshot in max_depth voxels.
+static size_t snapshot_volume(Octree::Octree *octree, Octree::NodeIndex node, uint16_t depth, uint16_t max_depth)
+{
+    Octree::OctreeNode *n = Octree::GetNode(octree, node);
+
+    if (!Octree::HasChildren(n)) {
+        return n->value ? size_t(1) << (3 * (max_depth - depth)) : 0;
+    }
+
+    size_t volume = 0;
+    for (size_t i = 0; i < 8; ++i) {
+        volume += snapshot_volume(octree, n->children[i], depth + 1, max_depth);
+    }
+
+    return volume;
+}
+
+//  One thread inserting and removing random voxels, publishing a version
+//  per edit, while readers walk whatever version is latest. The editor
+//  records the volume of every version it publishes and the readers check
+//  theirs against it, which fails if a node was reused under them.
+static void bench_snapshot(size_t edits, uint16_t depth, uint32_t reader_count)
+{
+    Octree::SnapshotOctree s;
+    Octree::SnapshotInit(&s);
+
+    size_t *volumes = new size_t[edits + 1];
+    volumes[0] = 0;
+
+    std::atomic<bool> done(false);
+    std::atomic<size_t> reads(0);
+    std::atomic<size_t> mismatches(0);
+
+    std::vector<std::thread> readers;
+    for (uint32_t r = 0; r < reader_count; ++r) {
+        readers.emplace_back([&]() {
+            uint32_t slot = Octree::SnapshotRegister(&s);
+
+            while (!done.load()) {
+                Octree::Snapshot snapshot = Octree::SnapshotAcquire(&s, slot);
+
+                if (snapshot_volume(&s.tree, snapshot.root, 0, depth) != volumes[snapshot.version]) {
+                    mismatches++;
+                }
+
+                Octree::SnapshotRelease(&s, slot);
+                reads++;
+            }
+
+            Octree::SnapshotUnregister(&s, slot);
+        });
+    }
+
+    size_t volume = 0;
+    double worst = 0;
+    double start = now_seconds();
+
+    for (size_t k = 0; k < edits; ++k) {
+        vec3 p = {random_float(-1, 1), random_float(-1, 1), random_float(-1, 1)};
+        bool remove = k % 4 == 3;
+
+        volumes[s.version + 1] = volume + (remove ? -1 : 1);
+
+        double edit = now_seconds();
+        bool changed = remove ? Octree::SnapshotRemovePoint(&s, p, depth) : Octree::SnapshotInsertPoint(&s, p, depth);
+        edit = now_seconds() - edit;
+        worst = edit > worst ? edit : worst;
+
+        if (changed) {
+            volume = volumes[s.version];
+        }
+    }
+
+    double elapsed = now_seconds() - start;
+    done = true;
+
+    for (size_t i = 0; i < readers.size(); ++i) {
+        readers[i].join();
+    }
+
+    fmt::print("Snapshots: {} readers, {:.2f} us/edit, worst {:.2f} us, {} versions, {} reads, {} mismatches\n",
+        reader_count, elapsed * 1e6 / edits, worst * 1e6, (size_t)s.version, reads.load(), mismatches.load());
+    fmt::print("Snapshots: {} live nodes, {} in the pool, {} retired waiting\n",
+        (size_t)(s.tree.used - s.tree.free_count) + 1, (size_t)s.tree.used + 1, s.retired_count - s.retired_head);
+
+    delete[] volumes;
+    Octree::SnapshotCleanup(&s);
+}
+
+static void bench_dag(uint16_t depth, size_t rays)
+{
+    Octree::Octree oct;
+    Octree::Init(&oct);
+
+    size_t count;
+    vec3 *points = terrain_points(&oct, depth, &count);
+    Octree::BuildFromPoints(&oct, points, count, depth);
+
+    Octree::Dag dag;
+    double start = now_seconds();
+    Octree::BuildDag(&dag, &oct);
+    double build = now_seconds() - start;
+
+    size_t nodes = (size_t)oct.used + 1;
+    size_t octree_bytes = nodes * sizeof(Octree::OctreeNode);
+    size_t compact_bytes = nodes * sizeof(Octree::CompactNode);
+
+    fmt::print("Dag: terrain depth {}, {} nodes, {} MB octree, BuildDag {:.3f} s, {:.1f} KB, {:.0f}x smaller ({:.0f}x against CompactNode)\n",
+        depth, nodes, octree_bytes >> 20, build, Octree::DagBytes(&dag) / 1024.0,
+        (double)octree_bytes / Octree::DagBytes(&dag), (double)compact_bytes / Octree::DagBytes(&dag));
+
+    start = now_seconds();
+    size_t octree_leaves = count_leaves(&oct, 0);
+    double octree_visit = now_seconds() - start;
+
+    size_t dag_leaves = 0;
+    start = now_seconds();
+    Octree::VisitLeaves(&dag, count_leaf, &dag_leaves);
+    double dag_visit = now_seconds() - start;
+
+    fmt::print("Dag: leaf walk {:.1f} ms octree ({} leaves), {:.1f} ms dag ({} leaves)\n",
+        octree_visit * 1e3, octree_leaves, dag_visit * 1e3, dag_leaves);
+
+    // Rays looking down onto the terrain from above at an angle.
+    vec3 *origins = new vec3[rays];
+    vec3 *dirs = new vec3[rays];
+
+    for (size_t i = 0; i < rays; ++i) {
+        origins[i][0] = random_float(-oct.size / 2, oct.size / 2);
+        origins[i][1] = oct.center[1] + oct.size;
+        origins[i][2] = random_float(-oct.size / 2, oct.size / 2);
+        dirs[i][0] = random_float(-0.5f, 0.5f);
+        dirs[i][1] = -1;
+        dirs[i][2] = random_float(-0.5f, 0.5f);
+        vec3_norm(dirs[i], dirs[i]);
+    }
+
+    size_t hits = 0;
+    start = now_seconds();
+    for (size_t i = 0; i < rays; ++i) {
+        Octree::RayHit hit;
+        hits += Octree::RayCast(&oct, origins[i], dirs[i], &hit);
+    }
+    double octree_rays = now_seconds() - start;
+
+    size_t dag_hits = 0;
+    start = now_seconds();
+    for (size_t i = 0; i < rays; ++i) {
+        Octree::RayHit hit;
+        dag_hits += Octree::RayCast(&dag, origins[i], dirs[i], &hit);
+    }
+    double dag_rays = now_seconds() - start;
+
+    fmt::print("Dag: RayCast {:.2f} Mrays/s octree ({} hits), {:.2f} Mrays/s dag ({} hits)\n",
+        rays / octree_rays * 1e-6, hits, rays / dag_rays * 1e-6, dag_hits);
+
+    delete[] dirs;
+    delete[] origins;
+    delete[] points;
+    Octree::Cleanup(&dag);
+    Octree::Cleanup(&oct);
+}
+
+static void bench_file(size_t count, uint16_t depth)
+{
+    const char *PATH = "bench_octree.bin";
+
+    Octree::Octree oct;
+    Octree::Init(&oct);
+
+    vec3 *points = sphere_points(&oct, count, oct.size * 0.4f);
+
+    double start = now_seconds();
+    Octree::BuildFromPoints(&oct, points, count, depth);
+    Octree::SampleHermite(&oct, sphere_distance, &oct);
+    double build = now_seconds() - start;
+
+    start = now_seconds();
+    bool saved = Octree::SaveOctree(&oct, PATH);
+    double save = now_seconds() - start;
+
+    Octree::OctreeFile file;
+    start = now_seconds();
+    bool opened = saved && Octree::OpenOctree(&file, PATH);
+    double open = now_seconds() - start;
+
+    if (!opened) {
+        fmt::print("OctreeFile: could not save and open {}\n", PATH);
+        delete[] points;
+        Octree::Cleanup(&oct);
+        return;
+    }
+
+    start = now_seconds();
+    size_t mapped_leaves = count_leaves(&file.octree, 0);
+    double first_walk = now_seconds() - start;
+
+    start = now_seconds();
+    size_t leaves = count_leaves(&oct, 0);
+    double walk = now_seconds() - start;
+
+    fmt::print("OctreeFile: {} MB, build {:.3f} s, save {:.3f} s, open {:.1f} us\n",
+        file.length >> 20, build, save, open * 1e6);
+    fmt::print("OctreeFile: first walk {:.1f} ms mapped ({} leaves), {:.1f} ms in memory ({} leaves)\n",
+        first_walk * 1e3, mapped_leaves, walk * 1e3, leaves);
+
+    // Growing the opened tree copies its pools out of the mapping first.
+    const size_t GROW_POINTS = 10000;
+    vec3 *extra = random_points(&file.octree, GROW_POINTS);
+
+    start = now_seconds();
+    for (size_t i = 0; i < GROW_POINTS; ++i) {
+        Octree::InsertPoint(&file.octree, 0, file.octree.center, extra[i], 0, depth);
+    }
+    double grow = now_seconds() - start;
+
+    fmt::print("OctreeFile: {} inserts into the opened tree {:.1f} ms, {} leaves after\n",
+        GROW_POINTS, grow * 1e3, count_leaves(&file.octree, 0));
+
+    delete[] extra;
+    Octree::CloseOctree(&file);
+
+    // Nodes freed before a save are reused after the reopen, not leaked.
+    const size_t REMOVE_POINTS = count / 10;
+
+    for (size_t i = 0; i < REMOVE_POINTS; ++i) {
+        Octree::RemovePoint(&oct, points[i], depth);
+    }
+
+    Octree::NodeIndex free_count = oct.free_count;
+
+    if (!Octree::SaveOctree(&oct, PATH) || !Octree::OpenOctree(&file, PATH)) {
+        fmt::print("OctreeFile: could not save and open {}\n", PATH);
+        delete[] points;
+        Octree::Cleanup(&oct);
+        return;
+    }
+
+    Octree::NodeIndex used = file.octree.used;
+    bool restored = file.octree.free_count == free_count
+        && file.octree.free_nodes == oct.free_nodes
+        && file.octree.free_hermite == oct.free_hermite;
+
+    for (size_t i = 0; i < REMOVE_POINTS; ++i) {
+        Octree::InsertPoint(&file.octree, 0, file.octree.center, points[i], 0, depth);
+    }
+
+    fmt::print("OctreeFile: {} removes, {} free nodes {}, reinserted with {} new nodes, {} still free\n",
+        REMOVE_POINTS, free_count, restored ? "reopened" : "LOST on reopen",
+        (size_t)(file.octree.used - used), file.octree.free_count);
+
+    Octree::CloseOctree(&file);
+    remove(PATH);
+
+    delete[] points;
+    Octree::Cleanup(&oct);
+}
+
+static void bench_paged(size_t count, uint16_t depth, uint16_t page_depth, size_t budget)
+{
+    const char *PATH = "bench_pages.bin";
+
+    Octree::Octree oct;
+    Octree::Init(&oct);
+    vec3 *points = random_points(&oct, count);
+
+    for (int batched = 0; batched < 2; ++batched) {
+        Octree::PagedOctree paged;
+        if (!Octree::Init(&paged, PATH, page_depth, budget)) {
+            fmt::print("PagedOctree: could not open {}\n", PATH);
+            break;
+        }
+
+        double start = now_seconds();
+        if (batched) {
+            Octree::InsertPoints(&paged, points, count, depth);
+        } else {
+            for (size_t i = 0; i < count; ++i) {
+                Octree::InsertPoint(&paged, points[i], depth);
+            }
+        }
+        Octree::Flush(&paged);
+        double insert = now_seconds() - start;
+
+        Octree::PagedStats stats = paged.stats;
+        fmt::print("PagedOctree {}: {:.3f} s, {} pages ({} MB) through {} MB, hit rate {:.3f}, {} evictions, {} writes\n",
+            batched ? "InsertPoints" : "InsertPoint ", insert, paged.page_count,
+            ((size_t)paged.page_count * sizeof(Octree::Page)) >> 20, budget >> 20,
+            Octree::HitRate(&stats), stats.evictions, stats.writes);
+
+        if (batched) {
+            paged.stats = {};
+            size_t leaves = 0;
+
+            start = now_seconds();
+            Octree::VisitLeaves(&paged, count_leaf, &leaves);
+            double visit = now_seconds() - start;
+
+            fmt::print("PagedOctree: VisitLeaves {:.3f} s, {} leaves, hit rate {:.3f}\n",
+                visit, leaves, Octree::HitRate(&paged.stats));
+
+            // Camera rays in scanline order, as in bench_raycast.
+            const size_t WIDTH = 512;
+            const size_t RAYS = WIDTH * WIDTH;
+            size_t hits = 0;
+            paged.stats = {};
+
+            start = now_seconds();
+            for (size_t i = 0; i < RAYS; ++i) {
+                vec3 origin = {paged.center[0], paged.center[1], paged.center[2] + paged.size * 1.5f};
+                vec3 target = {
+                    paged.center[0] + paged.size * ((i % WIDTH) / (float)WIDTH - 0.5f),
+                    paged.center[1] + paged.size * ((i / WIDTH) / (float)WIDTH - 0.5f),
+                    paged.center[2]
+                };
+                vec3 dir;
+                vec3_sub(dir, target, origin);
+                vec3_norm(dir, dir);
+
+                Octree::RayHit hit;
+                hits += Octree::RayCast(&paged, origin, dir, &hit);
+            }
+            double raycast = now_seconds() - start;
+
+            fmt::print("PagedOctree: RayCast {:.2f} Mrays/s, {} hits, hit rate {:.3f}, {} evictions\n",
+                RAYS / raycast * 1e-6, hits, Octree::HitRate(&paged.stats), paged.stats.evictions);
+        }
+
+        Octree::Cleanup(&paged);
+        remove(PATH);
+    }
+
+    delete[] points;
+    Octree::Cleanup(&oct);
+}
+
+int main(int argc, char **argv)
+{
+    size_t count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 10000000;
+    uint16_t depth = argc > 2 ? (uint16_t)atoi(argv[2]) : 8;
+
+    bench_insert_point(count, depth);
+    bench_node_layout(count, depth, 6);
+    bench_build_from_points(count, depth);
+    bench_build_parallel(count, depth);
+    bench_insert_latency(count, depth);
+    bench_raycast(count, depth + 2, 1000000);
+    bench_slab(1 << 16, 200);
+    bench_contour(count, depth + 2);
+    bench_brush(depth + 2);
+    bench_dirty(count, depth, 16);
+    bench_edit(count / 10, depth, 20);
+    bench_neighbours(count / 10, 12, 1000000);
+    bench_queries(count / 10, depth, 100000);
+    bench_debug_view(depth + 2);
+    bench_debug_lines(10 * 1000 * 1000, 6);
+    bench_dag(depth + 2, 1000000);
+    bench_snapshot(count / 10, depth, 2);
+    bench_file(count, depth + 2);
+    bench_paged(count / 10, depth + 2, 3, size_t(16) << 20);
+
+    return 0;
+}
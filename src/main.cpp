@@ -1,6 +1,7 @@
 #include "renderer/renderer.h"
 #include "renderer/debug.h"
 #include "octree/octree.h"
+#include "octree/edit.h"
 
 #include "math/math.h"
 
@@ -63,13 +64,282 @@ static void cursor_position_callback(GLFWwindow* window, double xpos, double ypo
     g_ypos = ypos;
 }
 
+//  Octree wireframe. It doesn't depend on the view, so it only changes with
+//  the tree. The tree is cut into a grid of chunks at WIREFRAME_CHUNK_DEPTH,
+//  each keeping its own line list, plus one chunk for the nodes above them.
+//  When the tree generation moves on, VisitDirty tells which chunks changed
+//  and only those are walked again; each swapchain image's copy of the
+//  buffer is then refreshed once. Frames where the tree didn't change only
+//  test the chunk boxes against the frustum and draw the visible runs.
+static const uint32_t WIREFRAME_CHUNK_DEPTH = 2;
+static const uint32_t WIREFRAME_GRID = 1 << WIREFRAME_CHUNK_DEPTH;
+static const uint32_t WIREFRAME_TOP = WIREFRAME_GRID * WIREFRAME_GRID * WIREFRAME_GRID;
+static const uint32_t WIREFRAME_CHUNKS = WIREFRAME_TOP + 1;
+static const size_t WIREFRAME_MAX_DEPTH = 8;
+
+//  Vertices each copy starts out with.
+static const size_t WIREFRAME_SIZE = 1024 * 64;
+
+//  `first` is where the chunk's lines start in the buffer copies.
+struct WireframeChunk {
+    vec3 *lines;
+    size_t count;
+    size_t len;
+    size_t first;
+    bool dirty;
+};
+
+struct WireframeDraw {
+    uint32_t first;
+    uint32_t count;
+};
+
+struct Wireframe {
+    DynamicVertexBuffer buffer;
+    WireframeChunk chunks[WIREFRAME_CHUNKS];
+    size_t count;
+    uint32_t generation;
+    uint32_t *generations;
+    WireframeDraw draws[WIREFRAME_CHUNKS];
+};
+
+void wireframe_init(Renderer *renderer, Wireframe *wireframe)
+{
+    create_dynamic_vertex_buffer(renderer, &wireframe->buffer, WIREFRAME_SIZE * sizeof(vec3));
+    wireframe->generations = (uint32_t *)calloc(wireframe->buffer.count, sizeof(uint32_t));
+    wireframe->count = 0;
+    wireframe->generation = 0;
+
+    for (uint32_t i = 0; i < WIREFRAME_CHUNKS; ++i) {
+        wireframe->chunks[i] = {};
+        wireframe->chunks[i].dirty = true;
+    }
+}
+
+//  Center of the chunk at grid position (x, y, z).
+static void wireframe_chunk_center(Octree::Octree *octree, uint32_t x, uint32_t y, uint32_t z, vec3 center)
+{
+    float size = octree->size / WIREFRAME_GRID;
+    uint32_t grid[3] = {x, y, z};
+
+    for (int k = 0; k < 3; ++k) {
+        center[k] = octree->center[k] - octree->size / 2 + (grid[k] + .5f) * size;
+    }
+}
+
+//  Grid position of the chunk holding p, clamped to the grid.
+static void wireframe_chunk_at(Octree::Octree *octree, const vec3 p, int32_t grid[3])
+{
+    for (int k = 0; k < 3; ++k) {
+        float t = (p[k] - octree->center[k] + octree->size / 2) / octree->size * WIREFRAME_GRID;
+        int32_t g = (int32_t)floorf(t);
+        grid[k] = g < 0 ? 0 : (g >= (int32_t)WIREFRAME_GRID ? WIREFRAME_GRID - 1 : g);
+    }
+}
+
+static uint32_t wireframe_chunk_index(int32_t x, int32_t y, int32_t z)
+{
+    return x + WIREFRAME_GRID * (y + WIREFRAME_GRID * z);
+}
+
+//  Marks the chunks a changed subtree reaches into. Nodes above the chunks
+//  also change the top chunk's lines.
+static void wireframe_dirty(Octree::Octree *octree, Octree::NodeIndex, const vec3 center, uint16_t depth, void *user)
+{
+    Wireframe *wireframe = (Wireframe *)user;
+
+    if (depth < WIREFRAME_CHUNK_DEPTH) {
+        wireframe->chunks[WIREFRAME_TOP].dirty = true;
+    }
+
+    float half = octree->size / (2 << depth) * .999f;
+    vec3 low = {center[0] - half, center[1] - half, center[2] - half};
+    vec3 high = {center[0] + half, center[1] + half, center[2] + half};
+
+    int32_t from[3], to[3];
+    wireframe_chunk_at(octree, low, from);
+    wireframe_chunk_at(octree, high, to);
+
+    for (int32_t z = from[2]; z <= to[2]; ++z) {
+        for (int32_t y = from[1]; y <= to[1]; ++y) {
+            for (int32_t x = from[0]; x <= to[0]; ++x) {
+                wireframe->chunks[wireframe_chunk_index(x, y, z)].dirty = true;
+            }
+        }
+    }
+}
+
+//  Walks the lines of one chunk again, growing its list until they fit.
+static void wireframe_build_chunk(Wireframe *wireframe, Octree::Octree *octree, uint32_t index)
+{
+    WireframeChunk *chunk = &wireframe->chunks[index];
+    Octree::NodeIndex node = 0;
+    vec3 center;
+    memcpy(center, octree->center, sizeof(vec3));
+    size_t depth = 0;
+
+    if (index != WIREFRAME_TOP) {
+        vec3 target;
+        wireframe_chunk_center(octree, index % WIREFRAME_GRID, index / WIREFRAME_GRID % WIREFRAME_GRID, index / (WIREFRAME_GRID * WIREFRAME_GRID), target);
+
+        for (; depth < WIREFRAME_CHUNK_DEPTH && Octree::HasChildren(octree, node); ++depth) {
+            uint32_t i = Octree::ChildIndex(center, target);
+
+            vec3 offset;
+            vec3_scale(offset, Octree::CHILDREN_CENTER_OFFSET[i], octree->size / (2 << depth));
+            vec3_add(center, center, offset);
+
+            node = Octree::GetNode(octree, node)->children[i];
+        }
+    }
+
+    chunk->count = 0;
+    chunk->dirty = false;
+
+    // The chunk lies inside a leaf above it, which draws nothing here.
+    if (index != WIREFRAME_TOP && depth < WIREFRAME_CHUNK_DEPTH) {
+        return;
+    }
+
+    size_t max_depth = index == WIREFRAME_TOP ? WIREFRAME_CHUNK_DEPTH : WIREFRAME_MAX_DEPTH;
+
+    for (;;) {
+        chunk->count = 0;
+        Octree::DebugLineList(octree, node, center, chunk->lines, chunk->len, depth, max_depth, &chunk->count);
+
+        // Less room left than one node's lines means some were dropped.
+        if (chunk->count + Octree::DEBUG_DIVISION_VERTS <= chunk->len) {
+            break;
+        }
+
+        chunk->len = chunk->len ? 2 * chunk->len : 4 * Octree::DEBUG_DIVISION_VERTS;
+        chunk->lines = (vec3 *)realloc(chunk->lines, chunk->len * sizeof(vec3));
+    }
+}
+
+//  Brings the chunks up to the tree's generation and the current frame's
+//  copy up to the chunks.
+void wireframe_update(Renderer *renderer, Wireframe *wireframe, Octree::Octree *octree)
+{
+    if (wireframe->generation != octree->generation) {
+        Octree::VisitDirty(octree, wireframe_dirty, wireframe);
+
+        //  A node leaves out a face its split neighbour on the high side
+        //  draws, so a chunk's changes can change the chunks below it too.
+        bool changed[WIREFRAME_TOP];
+
+        for (uint32_t i = 0; i < WIREFRAME_TOP; ++i) {
+            changed[i] = wireframe->chunks[i].dirty;
+        }
+
+        for (uint32_t i = 0; i < WIREFRAME_TOP; ++i) {
+            if (!changed[i]) {
+                continue;
+            }
+
+            int32_t grid[3] = {(int32_t)(i % WIREFRAME_GRID), (int32_t)(i / WIREFRAME_GRID % WIREFRAME_GRID), (int32_t)(i / (WIREFRAME_GRID * WIREFRAME_GRID))};
+
+            for (int k = 0; k < 3; ++k) {
+                if (grid[k] > 0) {
+                    grid[k]--;
+                    wireframe->chunks[wireframe_chunk_index(grid[0], grid[1], grid[2])].dirty = true;
+                    grid[k]++;
+                }
+            }
+        }
+
+        wireframe->count = 0;
+
+        for (uint32_t i = 0; i < WIREFRAME_CHUNKS; ++i) {
+            WireframeChunk *chunk = &wireframe->chunks[i];
+
+            if (chunk->dirty) {
+                wireframe_build_chunk(wireframe, octree, i);
+            }
+
+            chunk->first = wireframe->count;
+            wireframe->count += chunk->count;
+        }
+
+        wireframe->generation = octree->generation;
+    }
+
+    uint32_t frame = renderer->frame_index;
+
+    if (wireframe->generations[frame] != wireframe->generation) {
+        dynamic_vertex_buffer_reserve(renderer, &wireframe->buffer, wireframe->count * sizeof(vec3));
+        vec3 *lines = (vec3 *)dynamic_vertex_buffer_data(renderer, &wireframe->buffer);
+
+        for (uint32_t i = 0; i < WIREFRAME_CHUNKS; ++i) {
+            WireframeChunk *chunk = &wireframe->chunks[i];
+            memcpy(lines + chunk->first, chunk->lines, chunk->count * sizeof(vec3));
+        }
+
+        wireframe->generations[frame] = wireframe->generation;
+    }
+}
+
+//  Draws for the chunks in view, with neighbouring chunks in the buffer
+//  merged into one. Returns how many there are in wireframe->draws.
+uint32_t wireframe_cull(Wireframe *wireframe, Octree::Octree *octree, mat4x4 view_proj)
+{
+    Octree::DebugView view;
+    Octree::DebugViewInit(&view, view_proj, 1.f, 0.f);
+
+    float half = octree->size / (2 * WIREFRAME_GRID);
+    uint32_t count = 0;
+
+    for (uint32_t i = 0; i < WIREFRAME_CHUNKS; ++i) {
+        WireframeChunk *chunk = &wireframe->chunks[i];
+
+        if (!chunk->count) {
+            continue;
+        }
+
+        bool visible = true;
+
+        if (i != WIREFRAME_TOP) {
+            vec3 center;
+            wireframe_chunk_center(octree, i % WIREFRAME_GRID, i / WIREFRAME_GRID % WIREFRAME_GRID, i / (WIREFRAME_GRID * WIREFRAME_GRID), center);
+
+            for (int p = 0; p < 6 && visible; ++p) {
+                const float *plane = view.planes[p];
+                float distance = vec3_mul_dot(plane, center) + plane[3];
+                float radius = half * (fabsf(plane[0]) + fabsf(plane[1]) + fabsf(plane[2]));
+
+                visible = distance >= -radius;
+            }
+        }
+
+        if (!visible) {
+            continue;
+        }
+
+        if (count && wireframe->draws[count - 1].first + wireframe->draws[count - 1].count == chunk->first) {
+            wireframe->draws[count - 1].count += (uint32_t)chunk->count;
+        } else {
+            wireframe->draws[count++] = {(uint32_t)chunk->first, (uint32_t)chunk->count};
+        }
+    }
+
+    return count;
+}
+
+//  Octree nodes a brush edit visits per frame. Larger edits carry on over
+//  the following frames on a copy of the tree, which replaces the drawn
+//  one once the edit is done.
+static const size_t EDIT_BUDGET = 16384;
+
 int main() {
-    Octree::Octree oct;
-    Octree::Init(&oct);
+    Octree::Octree trees[2];
+    Octree::Init(&trees[0]);
+    Octree::Init(&trees[1]);
 
-//  Draw debug grid
-    vec3 lines[32000];
+    Octree::EditQueue edits;
+    Octree::EditQueueInit(&edits, &trees[0], &trees[1]);
+    Octree::Octree *oct = edits.shown;
 
+//  Draw debug grid
     vec3 glines[32000];
     size_t index = 0;
     int32_t grid_lines = 7;
@@ -105,9 +375,21 @@ int main() {
 
     material_update_descriptors(&renderer, &matoctree, &uniform);
 
+    Wireframe wireframe;
+    wireframe_init(&renderer, &wireframe);
+
+    FrameRing frame_ring;
+    create_frame_ring(&renderer, &frame_ring, 4 * DEBUG_CHUNK_SIZE * sizeof(vec3));
+
+    StagingRing staging;
+    staging_init(&renderer, &staging);
+
+    DebugShapes shapes;
+    debug_shapes_init(&renderer, &shapes, &staging);
+
     VertexBuffer grid_mesh;
-    create_vertex_buffer(&renderer, &grid_mesh, gcount * sizeof(vec3));
-    fill_vertex_buffer(&renderer, &grid_mesh, (void *)glines, gcount * sizeof(vec3));
+    create_static_vertex_buffer(&renderer, &staging, &grid_mesh, glines, gcount * sizeof(vec3));
+    staging_flush(&renderer, &staging);
 
     FPSCamera camera;
     create_fpscamera(&camera, to_radians(90.f), 4.f / 3.f, .01f, 1000.f);
@@ -121,6 +403,7 @@ int main() {
         // Draw a frame.
         VkCommandBuffer cmdbuffer;
         begin_frame(&renderer, &cmdbuffer);
+        frame_ring_begin(&renderer, &frame_ring);
 
         quat rot;
         fpscamera_rotation(&camera, to_radians(0.f) + g_xpos / 1000, to_radians(90.f) - g_ypos / 1000, rot);
@@ -130,30 +413,23 @@ int main() {
 
         if (freeze_time) {
             float tmin, tmax;
-            vec3 cam_dir;
+            vec3 cam_dir, inv_dir;
             quat_mul_vec3(cam_dir, rot, vec3{0, 0, -1});
+            ray_inverse(inv_dir, cam_dir);
 
-            // fmt::print("truth: {}\n", intersect_cube(camera_position, cam_dir, vec3{-oct.size / 2, -oct.size / 2, -oct.size / 2}, vec3{oct.size / 2, oct.size / 2, oct.size / 2}, &tmin, &tmax));
-            intersect_cube(camera_position, cam_dir, vec3{-oct.size / 2, -oct.size / 2, -oct.size / 2}, vec3{oct.size / 2, oct.size / 2, oct.size / 2}, &tmin, &tmax);
+            intersect_aabb(camera_position, inv_dir, vec3{-oct->size / 2, -oct->size / 2, -oct->size / 2}, vec3{oct->size / 2, oct->size / 2, oct->size / 2}, &tmin, &tmax);
             intersect_point(camera_position, cam_dir, tmin, pmin);
             intersect_point(camera_position, cam_dir, tmax, pmax);
 
-            Octree::InsertPoint(&oct, 0, oct.center, pmax, 0, 6);
+            Octree::Brush brush = {Octree::BRUSH_SPHERE, Octree::BRUSH_ADD, {pmax[0], pmax[1], pmax[2]}, {}, {}, .1f, 0xffff};
+            Octree::SubmitBrush(&edits, &brush, 6);
 
             fmt::print("{} {} {}\n", pmin[0], pmin[1], pmin[2]);
 
             freeze_time = false;
         }
 
-
-        size_t count = 0;
-        Octree::DebugLineList(&oct, 0, vec3{0, 0, 0}, lines, 32000, 0, 8, &count);
-        for (size_t i = 0; i < count; i += 2) {
-            debug_renderer_drawline(&debug, lines[i], lines[i + 1]);
-        }
-
-        debug_renderer_drawsphere(&debug, pmin, .1f, 8);
-        debug_renderer_drawsphere(&debug, pmax, .1f, 8);
+        oct = Octree::UpdateEdits(&edits, EDIT_BUDGET);
 
         vec3_scale(delta, delta, 1.f / 1000.f);
 
@@ -161,6 +437,12 @@ int main() {
         vec3_add(camera_position, camera_position, delta);
         fpscamera_view(&camera, camera_position, rot, view);
 
+        wireframe_update(&renderer, &wireframe, oct);
+        uint32_t wireframe_draws = wireframe_cull(&wireframe, oct, view);
+
+        debug_shapes_sphere(&shapes, pmin, .1f, vec3{.8f, .2f, .2f});
+        debug_shapes_sphere(&shapes, pmax, .1f, vec3{.2f, .2f, .8f});
+
         mat4x4 model;
         mat4x4_translate(model, 0, 0, 0);
 
@@ -194,16 +476,25 @@ int main() {
         vkCmdBindVertexBuffers(cmdbuffer, 0, 1, vertexBuffers, offsets);
         vkCmdDraw(cmdbuffer, gcount, 1, 0, 0);
 
-        // Draw debug primitives
-        if (debug.count) {
-            uint32_t debug_count;
-            debug_renderer_flush(&renderer, &debug, &debug_count);
+        // Draw the octree
+        if (wireframe_draws) {
+            VkBuffer wireframe_buffer = dynamic_vertex_buffer_current(&renderer, &wireframe.buffer);
 
+            vkCmdBindVertexBuffers(cmdbuffer, 0, 1, &wireframe_buffer, offsets);
+
+            for (uint32_t i = 0; i < wireframe_draws; ++i) {
+                vkCmdDraw(cmdbuffer, wireframe.draws[i].count, 1, wireframe.draws[i].first, 0);
+            }
+        }
+
+        // Draw debug primitives
+        if (debug_renderer_count(&debug)) {
             vkCmdPushConstants(cmdbuffer, matoctree.layout, VK_SHADER_STAGE_VERTEX_BIT, 0, 128, mvp);
-            vkCmdBindVertexBuffers(cmdbuffer, 0, 1, &debug.buffer.buffer, offsets);
-            vkCmdDraw(cmdbuffer, debug_count, 1, 0, 0);
+            debug_renderer_flush(&renderer, &debug, &frame_ring, cmdbuffer);
         }
 
+        debug_shapes_flush(&renderer, &shapes, &frame_ring, cmdbuffer, mvp);
+
         vkCmdEndRenderPass(cmdbuffer);
 
         vkEndCommandBuffer(cmdbuffer);
@@ -215,7 +506,11 @@ int main() {
         if (time_since_last + 1 < glfwGetTime()) {
             time_since_last = glfwGetTime();
 
+            AllocatorStats stats = allocator_stats(&renderer.allocator);
+
             fmt::print("FPS: {}\n", frame_counter);
+            fmt::print("memory: {} blocks, {} allocations, {} / {} KiB, {:.0f}% fragmented\n",
+                stats.blocks, stats.allocations, stats.used / 1024, stats.reserved / 1024, 100 * stats.fragmentation);
             frame_counter = 0;
         }
     }
@@ -1,4 +1,8 @@
+#ifndef MATH_MATH_H
+#define MATH_MATH_H
+
 #include <linmath.h>
+#include <immintrin.h>
 
 void swapf(float *a, float *b)
 {
@@ -26,59 +30,149 @@ bool intersect_plane(const vec3 l0, const vec3 l, const vec3 p0, const vec3 n, f
     return false; 
 }
 
-//TODO: Make it faster.
+static inline float minf(float a, float b)
+{
+    return a < b ? a : b;
+}
+
+static inline float maxf(float a, float b)
+{
+    return a > b ? a : b;
+}
+
+void ray_inverse(vec3 inv, const vec3 l)
+{
+    inv[0] = 1.f / l[0];
+    inv[1] = 1.f / l[1];
+    inv[2] = 1.f / l[2];
+}
+
+// Slab test against a precomputed inverse direction. Returns whether the
+// slabs overlap; tmin may be negative when l0 is inside or past the box.
+bool intersect_aabb(const vec3 l0, const vec3 inv, const vec3 min, const vec3 max, float *tmin, float *tmax)
+{
+    float t0x = (min[0] - l0[0]) * inv[0], t1x = (max[0] - l0[0]) * inv[0];
+    float t0y = (min[1] - l0[1]) * inv[1], t1y = (max[1] - l0[1]) * inv[1];
+    float t0z = (min[2] - l0[2]) * inv[2], t1z = (max[2] - l0[2]) * inv[2];
+
+    *tmin = maxf(maxf(minf(t0x, t1x), minf(t0y, t1y)), minf(t0z, t1z));
+    *tmax = minf(minf(maxf(t0x, t1x), maxf(t0y, t1y)), maxf(t0z, t1z));
+
+    return *tmin <= *tmax;
+}
+
 bool intersect_cube(const vec3 l0, const vec3 l, vec3 min, vec3 max, float *tmin, float *tmax)
 {
-    intersect_plane(l0, l, min, vec3{1, 0, 0}, tmin);
-    intersect_plane(l0, l, max, vec3{-1, 0, 0}, tmax);
+    vec3 inv;
+    ray_inverse(inv, l);
+
+    return intersect_aabb(l0, inv, min, max, tmin, tmax);
+}
+
+// Packet variants, laid out one component per register. Each returns a
+// bit mask of the lanes whose slabs overlap, like intersect_aabb.
+struct RayPacket4 {
+    __m128 ox, oy, oz;
+    __m128 ix, iy, iz;
+};
+
+struct AABB4 {
+    __m128 minx, miny, minz;
+    __m128 maxx, maxy, maxz;
+};
+
+static inline void slab4(__m128 o, __m128 inv, __m128 min, __m128 max, __m128 *tmin, __m128 *tmax)
+{
+    __m128 t0 = _mm_mul_ps(_mm_sub_ps(min, o), inv);
+    __m128 t1 = _mm_mul_ps(_mm_sub_ps(max, o), inv);
+
+    *tmin = _mm_max_ps(*tmin, _mm_min_ps(t0, t1));
+    *tmax = _mm_min_ps(*tmax, _mm_max_ps(t0, t1));
+}
+
+// Four rays against one box.
+int intersect_aabb_rays4(const RayPacket4 *rays, const vec3 min, const vec3 max, float tmin[4], float tmax[4])
+{
+    __m128 t0 = _mm_set1_ps(-INFINITY);
+    __m128 t1 = _mm_set1_ps(INFINITY);
+
+    slab4(rays->ox, rays->ix, _mm_set1_ps(min[0]), _mm_set1_ps(max[0]), &t0, &t1);
+    slab4(rays->oy, rays->iy, _mm_set1_ps(min[1]), _mm_set1_ps(max[1]), &t0, &t1);
+    slab4(rays->oz, rays->iz, _mm_set1_ps(min[2]), _mm_set1_ps(max[2]), &t0, &t1);
+
+    _mm_storeu_ps(tmin, t0);
+    _mm_storeu_ps(tmax, t1);
+
+    return _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+}
+
+// One ray against four boxes.
+int intersect_aabb4(const vec3 l0, const vec3 inv, const AABB4 *boxes, float tmin[4], float tmax[4])
+{
+    __m128 t0 = _mm_set1_ps(-INFINITY);
+    __m128 t1 = _mm_set1_ps(INFINITY);
+
+    slab4(_mm_set1_ps(l0[0]), _mm_set1_ps(inv[0]), boxes->minx, boxes->maxx, &t0, &t1);
+    slab4(_mm_set1_ps(l0[1]), _mm_set1_ps(inv[1]), boxes->miny, boxes->maxy, &t0, &t1);
+    slab4(_mm_set1_ps(l0[2]), _mm_set1_ps(inv[2]), boxes->minz, boxes->maxz, &t0, &t1);
 
-    if (*tmin > *tmax) {
-        swapf(tmin, tmax);
-    }
+    _mm_storeu_ps(tmin, t0);
+    _mm_storeu_ps(tmax, t1);
 
-    float tymin,
-          tymax;
+    return _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+}
 
-    intersect_plane(l0, l, min, vec3{0, 1, 0}, &tymin);
-    intersect_plane(l0, l, max, vec3{0, -1, 0}, &tymax);
+#ifdef __AVX__
+struct RayPacket8 {
+    __m256 ox, oy, oz;
+    __m256 ix, iy, iz;
+};
 
-    if (tymin > tymax) {
-        swapf(&tymin, &tymax);
-    }
+struct AABB8 {
+    __m256 minx, miny, minz;
+    __m256 maxx, maxy, maxz;
+};
+
+static inline void slab8(__m256 o, __m256 inv, __m256 min, __m256 max, __m256 *tmin, __m256 *tmax)
+{
+    __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(min, o), inv);
+    __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(max, o), inv);
 
-    if (*tmin > tymax || tymin > *tmax) {
-        return false;
-    }
+    *tmin = _mm256_max_ps(*tmin, _mm256_min_ps(t0, t1));
+    *tmax = _mm256_min_ps(*tmax, _mm256_max_ps(t0, t1));
+}
 
-    if (tymin > *tmin) {
-        *tmin = tymin;
-    }
+// Eight rays against one box.
+int intersect_aabb_rays8(const RayPacket8 *rays, const vec3 min, const vec3 max, float tmin[8], float tmax[8])
+{
+    __m256 t0 = _mm256_set1_ps(-INFINITY);
+    __m256 t1 = _mm256_set1_ps(INFINITY);
 
-    if (tymax < *tmax) {
-        *tmax = tymax;
-    }
+    slab8(rays->ox, rays->ix, _mm256_set1_ps(min[0]), _mm256_set1_ps(max[0]), &t0, &t1);
+    slab8(rays->oy, rays->iy, _mm256_set1_ps(min[1]), _mm256_set1_ps(max[1]), &t0, &t1);
+    slab8(rays->oz, rays->iz, _mm256_set1_ps(min[2]), _mm256_set1_ps(max[2]), &t0, &t1);
 
-    float tzmin,
-          tzmax;
+    _mm256_storeu_ps(tmin, t0);
+    _mm256_storeu_ps(tmax, t1);
 
-    intersect_plane(l0, l, min, vec3{0, 0, 1}, &tzmin);
-    intersect_plane(l0, l, max, vec3{0, 0, -1}, &tzmax);
+    return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ));
+}
 
-    if (tzmin > tzmax) {
-        swapf(&tzmin, &tzmax);
-    }
+// One ray against eight boxes.
+int intersect_aabb8(const vec3 l0, const vec3 inv, const AABB8 *boxes, float tmin[8], float tmax[8])
+{
+    __m256 t0 = _mm256_set1_ps(-INFINITY);
+    __m256 t1 = _mm256_set1_ps(INFINITY);
 
-    if (*tmin > tzmax || tzmin > *tmax) {
-        return false;
-    }
+    slab8(_mm256_set1_ps(l0[0]), _mm256_set1_ps(inv[0]), boxes->minx, boxes->maxx, &t0, &t1);
+    slab8(_mm256_set1_ps(l0[1]), _mm256_set1_ps(inv[1]), boxes->miny, boxes->maxy, &t0, &t1);
+    slab8(_mm256_set1_ps(l0[2]), _mm256_set1_ps(inv[2]), boxes->minz, boxes->maxz, &t0, &t1);
 
-    if (tzmin > *tmin) {
-        *tmin = tzmin;
-    }
+    _mm256_storeu_ps(tmin, t0);
+    _mm256_storeu_ps(tmax, t1);
 
-    if (tzmax < *tmax) {
-        *tmax = tzmax;
-    }
-    
-    return true;
+    return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ));
 }
+#endif
+
+#endif
@@ -0,0 +1,339 @@
+#ifndef OCTREE_BUILD_H
+#define OCTREE_BUILD_H
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "octree.h"
+
+namespace Octree {
+
+//  Morton codes hold three bits per level, most significant level first, and
+//  each triple is laid out like a child index (x high = 1, y low = 2,
+//  z high = 4), so sorting the codes visits leaves in tree order.
+const uint16_t MORTON_MAX_DEPTH = 21;
+
+static uint64_t MortonSpread(uint64_t x)
+{
+    x &= 0x1fffff;
+    x = (x | x << 32) & 0x001f00000000ffffull;
+    x = (x | x << 16) & 0x001f0000ff0000ffull;
+    x = (x | x << 8)  & 0x100f00f00f00f00full;
+    x = (x | x << 4)  & 0x10c30c30c30c30c3ull;
+    x = (x | x << 2)  & 0x1249249249249249ull;
+    return x;
+}
+
+//  Points exactly on a split plane go where InsertPoint sends them: to the
+//  low half in x and z and to the high half in y.
+static uint32_t MortonQuantize(double v, double min, double scale, uint32_t cells, bool ties_high)
+{
+    double q = (v - min) * scale;
+    q = ties_high ? floor(q) : ceil(q) - 1;
+
+    if (q <= 0) {
+        return 0;
+    }
+
+    return q >= cells ? cells - 1 : (uint32_t)q;
+}
+
+uint64_t MortonEncode(const vec3 center, float size, const vec3 p, uint16_t max_depth)
+{
+    uint32_t cells = 1u << max_depth;
+    double scale = cells / (double)size;
+    double half = size / 2.0;
+
+    uint32_t x = MortonQuantize(p[0], center[0] - half, scale, cells, false);
+    uint32_t y = MortonQuantize(p[1], center[1] - half, scale, cells, true);
+    uint32_t z = MortonQuantize(p[2], center[2] - half, scale, cells, false);
+
+    return MortonSpread(x) | MortonSpread(~y & (cells - 1)) << 1 | MortonSpread(z) << 2;
+}
+
+uint64_t MortonEncode(Octree *octree, const vec3 p, uint16_t max_depth)
+{
+    return MortonEncode(octree->center, octree->size, p, max_depth);
+}
+
+//  LSD radix sort over the low `bits` bits, one byte per pass. `temp` must
+//  hold `count` codes; the result ends up back in `codes`.
+void RadixSort(uint64_t *codes, uint64_t *temp, size_t count, uint32_t bits)
+{
+    uint64_t *src = codes;
+    uint64_t *dst = temp;
+
+    for (uint32_t shift = 0; shift < bits; shift += 8) {
+        size_t offsets[256] = {};
+
+        for (size_t i = 0; i < count; ++i) {
+            offsets[(src[i] >> shift) & 0xff]++;
+        }
+
+        size_t sum = 0;
+        for (size_t i = 0; i < 256; ++i) {
+            size_t n = offsets[i];
+            offsets[i] = sum;
+            sum += n;
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            dst[offsets[(src[i] >> shift) & 0xff]++] = src[i];
+        }
+
+        uint64_t *swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    if (src != codes) {
+        memcpy(codes, src, count * sizeof(uint64_t));
+    }
+}
+
+//  Level at which code i leaves the path of code i - 1, or max_depth for
+//  a duplicate.
+static uint16_t SplitLevel(const uint64_t *codes, size_t i, uint16_t depth, uint16_t max_depth)
+{
+    if (!i) {
+        return depth;
+    }
+
+    uint64_t diff = codes[i] ^ codes[i - 1];
+    return diff ? max_depth - 1 - HighestBit(diff) / 3 : max_depth;
+}
+
+//  Gives a fresh node the eight consecutive children starting at first.
+static void SplitBlock(Octree *octree, NodeIndex node, NodeIndex first)
+{
+    OctreeNode *parent = GetNode(octree, node);
+
+    for (size_t i = 0; i < 8; ++i) {
+        OctreeNode *child = GetNode(octree, first + i);
+        *child = {};
+        child->parent = node;
+        parent->children[i] = first + i;
+    }
+}
+
+size_t CountBuildNodes(const uint64_t *codes, size_t count, uint16_t depth, uint16_t max_depth)
+{
+    size_t nodes = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        uint16_t level = SplitLevel(codes, i, depth, max_depth);
+
+        if (level < max_depth) {
+            nodes += 8 * (max_depth - level - (i ? 1 : 0));
+        }
+    }
+
+    return nodes;
+}
+
+//  Emits the tree for sorted codes under a fresh node in one pass, taking
+//  nodes in blocks of eight from `next` on and returning the first unused
+//  index. Consecutive codes share the path down to the level where they
+//  first differ, so only the levels below that are split.
+NodeIndex BuildFromCodes(Octree *octree, NodeIndex root, const uint64_t *codes, size_t count, uint16_t depth, uint16_t max_depth, NodeIndex next)
+{
+    NodeIndex path[MORTON_MAX_DEPTH + 1];
+    path[depth] = root;
+
+    for (size_t i = 0; i < count; ++i) {
+        uint16_t level = SplitLevel(codes, i, depth, max_depth);
+
+        if (level >= max_depth && i) {
+            continue;
+        }
+
+        for (uint16_t l = level; l < max_depth; ++l) {
+            if (l > level || !i) {
+                SplitBlock(octree, path[l], next);
+                next += 8;
+            }
+
+            uint32_t child = (codes[i] >> (3 * (max_depth - 1 - l))) & 7;
+            path[l + 1] = GetNode(octree, path[l])->children[child];
+        }
+
+        GetNode(octree, path[max_depth])->value = 0xffff;
+    }
+
+    return next;
+}
+
+void BuildFromPoints(Octree *octree, const vec3 *points, size_t count, uint16_t max_depth)
+{
+    assert(max_depth <= MORTON_MAX_DEPTH);
+
+    Clear(octree);
+
+    uint64_t *codes = new uint64_t[count];
+    uint64_t *temp = new uint64_t[count];
+
+    for (size_t i = 0; i < count; ++i) {
+        codes[i] = MortonEncode(octree, points[i], max_depth);
+    }
+
+    RadixSort(codes, temp, count, 3 * max_depth);
+
+    size_t nodes = CountBuildNodes(codes, count, 0, max_depth);
+    assert((NodeIndex)nodes == nodes);
+    PoolReserve(&octree->nodes, nodes + 1);
+
+    octree->used = BuildFromCodes(octree, 0, codes, count, 0, max_depth, 1) - 1;
+
+    delete[] temp;
+    delete[] codes;
+}
+
+template <typename F>
+static void ParallelFor(uint32_t thread_count, size_t count, F fn)
+{
+    std::atomic<size_t> next(0);
+
+    auto worker = [&]() {
+        for (size_t i = next++; i < count; i = next++) {
+            fn(i);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (uint32_t i = 1; i < thread_count; ++i) {
+        threads.emplace_back(worker);
+    }
+
+    worker();
+
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+}
+
+//  Parallel BuildFromPoints. Codes are bucketed by their top `split` levels
+//  with a counting sort, each bucket is sorted and counted on its own, and
+//  the top levels are built serially. Every bucket then builds its subtree
+//  on a worker into its own range of the node pool, right under the node
+//  the top levels left for it.
+void BuildFromPointsParallel(Octree *octree, const vec3 *points, size_t count, uint16_t max_depth, uint32_t thread_count = 0)
+{
+    assert(max_depth <= MORTON_MAX_DEPTH);
+
+    if (!thread_count) {
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    Clear(octree);
+
+    const size_t STRIPE = 1 << 16;
+    size_t stripes = (count + STRIPE - 1) / STRIPE;
+
+    uint16_t split = 1;
+    while (split < 3 && split < max_depth && (1u << (3 * split)) < 8 * thread_count) {
+        ++split;
+    }
+    split = std::min(split, max_depth);
+
+    uint32_t shift = 3 * (max_depth - split);
+    size_t buckets = size_t(1) << (3 * split);
+
+    uint64_t *codes = new uint64_t[count];
+    uint64_t *temp = new uint64_t[count];
+    size_t *offsets = new size_t[stripes * buckets]();
+
+    ParallelFor(thread_count, stripes, [&](size_t stripe) {
+        size_t *histogram = &offsets[stripe * buckets];
+
+        for (size_t i = stripe * STRIPE; i < std::min(count, (stripe + 1) * STRIPE); ++i) {
+            codes[i] = MortonEncode(octree, points[i], max_depth);
+            histogram[codes[i] >> shift]++;
+        }
+    });
+
+    size_t *bucket_start = new size_t[buckets + 1];
+    size_t sum = 0;
+
+    for (size_t b = 0; b < buckets; ++b) {
+        bucket_start[b] = sum;
+
+        for (size_t stripe = 0; stripe < stripes; ++stripe) {
+            size_t n = offsets[stripe * buckets + b];
+            offsets[stripe * buckets + b] = sum;
+            sum += n;
+        }
+    }
+    bucket_start[buckets] = sum;
+
+    ParallelFor(thread_count, stripes, [&](size_t stripe) {
+        size_t *offset = &offsets[stripe * buckets];
+
+        for (size_t i = stripe * STRIPE; i < std::min(count, (stripe + 1) * STRIPE); ++i) {
+            temp[offset[codes[i] >> shift]++] = codes[i];
+        }
+    });
+
+    size_t *bucket_nodes = new size_t[buckets];
+
+    ParallelFor(thread_count, buckets, [&](size_t b) {
+        size_t first = bucket_start[b];
+        size_t n = bucket_start[b + 1] - first;
+
+        RadixSort(&temp[first], &codes[first], n, shift);
+        bucket_nodes[b] = CountBuildNodes(&temp[first], n, split, max_depth);
+    });
+
+    NodeIndex *bucket_root = new NodeIndex[buckets];
+
+    for (size_t b = 0; b < buckets; ++b) {
+        if (bucket_start[b] == bucket_start[b + 1]) {
+            continue;
+        }
+
+        NodeIndex node = 0;
+        for (uint16_t l = 0; l < split; ++l) {
+            if (!HasChildren(octree, node)) {
+                SplitNode(octree, node);
+            }
+
+            node = GetNode(octree, node)->children[(b >> (3 * (split - 1 - l))) & 7];
+        }
+
+        bucket_root[b] = node;
+    }
+
+    //  Turn the per-bucket node counts into the first index of each range.
+    size_t next = (size_t)octree->used + 1;
+    for (size_t b = 0; b < buckets; ++b) {
+        size_t n = bucket_nodes[b];
+        bucket_nodes[b] = next;
+        next += n;
+    }
+
+    assert((NodeIndex)next == next);
+    PoolReserve(&octree->nodes, next);
+
+    ParallelFor(thread_count, buckets, [&](size_t b) {
+        size_t first = bucket_start[b];
+        size_t n = bucket_start[b + 1] - first;
+
+        if (n) {
+            BuildFromCodes(octree, bucket_root[b], &temp[first], n, split, max_depth, bucket_nodes[b]);
+        }
+    });
+
+    octree->used = next - 1;
+
+    delete[] bucket_root;
+    delete[] bucket_nodes;
+    delete[] bucket_start;
+    delete[] offsets;
+    delete[] temp;
+    delete[] codes;
+}
+
+}
+
+#endif
@@ -0,0 +1,182 @@
+#ifndef OCTREE_COMPACT_H
+#define OCTREE_COMPACT_H
+
+#include "octree.h"
+
+namespace Octree {
+
+//  Compact node format. The eight children of a node live in one contiguous
+//  block starting at first_child, and the node keeps two masks over them:
+//  child_mask marks non-empty children, leaf_mask the ones that are occupied
+//  leaves. Empty children and leaves never get a block of their own, and a
+//  node whose children are all leaves has no block at all (first_child 0).
+
+#pragma pack(push, 1)
+struct CompactNode {
+    NodeIndex first_child;
+    uint8_t child_mask;
+    uint8_t leaf_mask;
+};
+#pragma pack(pop)
+
+struct CompactOctree {
+    vec3 center;
+    float size;
+    Pool<CompactNode> nodes;
+    NodeIndex used;
+    bool full;
+};
+
+void Init(CompactOctree *octree)
+{
+    PoolInit(&octree->nodes);
+    PoolReserve(&octree->nodes, BLOCK_SIZE);
+
+    // The root sits alone in block 0 so every later block stays 8-aligned.
+    for (size_t i = 0; i < 8; ++i) {
+        *PoolGet(&octree->nodes, i) = {};
+    }
+
+    octree->used = 8;
+    octree->full = false;
+    memcpy(octree->center, vec3{0, 0, 0}, sizeof(vec3));
+    octree->size = 4;
+}
+
+CompactNode * GetNode(CompactOctree *octree, NodeIndex node)
+{
+    return PoolGet(&octree->nodes, node);
+}
+
+void SplitNode(CompactOctree *octree, NodeIndex node)
+{
+    assert((NodeIndex)(octree->used + 8) > octree->used);
+    PoolReserve(&octree->nodes, (size_t)octree->used + 8);
+
+    NodeIndex first = octree->used;
+    octree->used += 8;
+
+    for (size_t i = 0; i < 8; ++i) {
+        *GetNode(octree, first + i) = {};
+    }
+
+    GetNode(octree, node)->first_child = first;
+}
+
+bool HasChildren(CompactOctree *octree, NodeIndex node)
+{
+    return GetNode(octree, node)->child_mask;
+}
+
+void InsertPoint(CompactOctree *octree, NodeIndex node, vec3 center, vec3 p, uint16_t depth, uint16_t max_depth)
+{
+    if (depth >= max_depth) {
+        octree->full = true;
+        return;
+    }
+
+    vec3 c;
+    memcpy(c, center, sizeof(vec3));
+    float scale = octree->size / (size_t(2) << depth);
+
+    for (;;) {
+        uint32_t i = ChildIndex(c, p);
+        uint8_t bit = 1 << i;
+
+        if (GetNode(octree, node)->leaf_mask & bit) {
+            return;
+        }
+
+        if (++depth >= max_depth) {
+            GetNode(octree, node)->child_mask |= bit;
+            GetNode(octree, node)->leaf_mask |= bit;
+            return;
+        }
+
+        // Only a child that is an inner node needs the block.
+        if (!GetNode(octree, node)->first_child) {
+            SplitNode(octree, node);
+        }
+
+        CompactNode *n = GetNode(octree, node);
+        n->child_mask |= bit;
+
+        vec3 offset;
+        vec3_scale(offset, CHILDREN_CENTER_OFFSET[i], scale);
+        vec3_add(c, c, offset);
+        scale *= 0.5f;
+
+        node = n->first_child + i;
+    }
+}
+
+//  Bit of a child index that moves along each face of DEBUG_FACE_STEPS. A
+//  set bit is the high side for x and z but the low side for y.
+const uint32_t DEBUG_FACE_BITS[3] = {2, 1, 4};
+
+//  Split node of the same size as child i of `parent` across face f, or 0.
+//  It is a sibling, or a child of the parent's neighbour across that face.
+static NodeIndex SplitNeighbour(CompactOctree *octree, NodeIndex parent, NodeIndex parent_neighbour, uint32_t i, uint32_t f)
+{
+    uint32_t bit = DEBUG_FACE_BITS[f];
+    bool high = (i & bit) ? f != 0 : f == 0;
+
+    if (high && !parent_neighbour) {
+        return 0;
+    }
+
+    uint32_t j = i ^ bit;
+    CompactNode *n = GetNode(octree, high ? parent_neighbour : parent);
+
+    return (n->child_mask & ~n->leaf_mask & (1 << j)) ? n->first_child + j : 0;
+}
+
+//  Same lines as the Octree DebugLineList. There are no parent links, so the
+//  split neighbours across the +y, +x and +z faces are passed down instead.
+void DebugLineList(CompactOctree *octree, NodeIndex node, vec3 start, vec3 *vert, size_t len, size_t depth, size_t max_depth, size_t *index, const NodeIndex *neighbours = nullptr)
+{
+    if (!HasChildren(octree, node) || depth == max_depth) {
+        return;
+    }
+
+    uint32_t faces = DEBUG_ALL_FACES;
+
+    for (uint32_t f = 0; neighbours && f < 3; ++f) {
+        if (neighbours[f]) {
+            faces &= ~(1 << (2 * f));
+        }
+    }
+
+    if (!DebugDivision(start, octree->size / (size_t(1) << depth), vert, len, index, faces)) {
+        return;
+    }
+
+    CompactNode *n = GetNode(octree, node);
+    uint8_t internal = n->child_mask & ~n->leaf_mask;
+
+    for (uint32_t i = 0; i < 8; ++i) {
+        if (!(internal & (1 << i))) {
+            continue;
+        }
+
+        NodeIndex child_neighbours[3];
+        for (uint32_t f = 0; f < 3; ++f) {
+            child_neighbours[f] = SplitNeighbour(octree, node, neighbours ? neighbours[f] : 0, i, f);
+        }
+
+        vec3 child_start;
+        vec3_scale(child_start, CHILDREN_CENTER_OFFSET[i], 1.0f * octree->size / (2<<depth));
+        vec3_add(child_start, start, child_start);
+
+        DebugLineList(octree, n->first_child + i, child_start, vert, len, depth + 1, max_depth, index, child_neighbours);
+    }
+}
+
+void Cleanup(CompactOctree *octree)
+{
+    PoolCleanup(&octree->nodes);
+}
+
+}
+
+#endif
@@ -0,0 +1,489 @@
+#ifndef OCTREE_CONTOUR_H
+#define OCTREE_CONTOUR_H
+
+#include <stdlib.h>
+
+#include "octree.h"
+
+namespace Octree {
+
+//  Dual contouring (Ju et al., "Dual Contouring of Hermite Data"). Every leaf
+//  with Hermite data gets one vertex, placed by minimizing the quadratic
+//  error to the tangent planes at its edge crossings, and every minimal edge
+//  with a sign change emits a quad joining the vertices of the four leaves
+//  around it. Triangles wind counter-clockwise seen from outside.
+//
+//  Edges run along the bit space axes (x, -y, z) of the child index, four per
+//  axis, from the corner with the axis bit clear to the one with it set.
+
+const uint8_t EDGE_CORNERS[12][2] = {
+    {0, 1}, {2, 3}, {4, 5}, {6, 7},
+    {0, 2}, {1, 3}, {4, 6}, {5, 7},
+    {0, 4}, {1, 5}, {2, 6}, {3, 7},
+};
+
+//  The two axes across an edge along each axis, and the positions of the
+//  four cells around the edge in order (low, low), (high, low), (high,
+//  high), (low, high) across them.
+const uint8_t EDGE_AXES[3][2] = {{1, 2}, {0, 2}, {0, 1}};
+const uint8_t QUAD_SIDES[4][2] = {{0, 0}, {1, 0}, {1, 1}, {0, 1}};
+
+//  Sign of the quad normal along each bit space axis, for cells taken in
+//  QUAD_SIDES order. The y bit runs along -y, so only y keeps its sign.
+const int QUAD_WINDING[3] = {-1, 1, -1};
+
+//  Pull of the mass point in the QEF, per edge crossing. Small enough to
+//  keep sharp features, large enough to hold flat regions in place.
+const float QEF_BIAS = 0.01f;
+
+typedef float (*DistanceFn)(const vec3 p, void *user);
+
+struct Mesh {
+    vec3 *vertices;
+    uint32_t *indices;
+    size_t vertex_count;
+    size_t vertex_capacity;
+    size_t index_count;
+    size_t index_capacity;
+};
+
+void MeshInit(Mesh *mesh)
+{
+    *mesh = {};
+}
+
+void MeshCleanup(Mesh *mesh)
+{
+    free(mesh->vertices);
+    free(mesh->indices);
+    *mesh = {};
+}
+
+static uint32_t MeshPushVertex(Mesh *mesh, const vec3 v)
+{
+    if (mesh->vertex_count == mesh->vertex_capacity) {
+        mesh->vertex_capacity = mesh->vertex_capacity ? 2 * mesh->vertex_capacity : BLOCK_SIZE;
+        mesh->vertices = (vec3 *)realloc(mesh->vertices, mesh->vertex_capacity * sizeof(vec3));
+    }
+
+    memcpy(mesh->vertices[mesh->vertex_count], v, sizeof(vec3));
+    return (uint32_t)mesh->vertex_count++;
+}
+
+static void MeshPushTriangle(Mesh *mesh, uint32_t a, uint32_t b, uint32_t c)
+{
+    if (a == b || b == c || a == c) {
+        return;
+    }
+
+    if (mesh->index_count + 3 > mesh->index_capacity) {
+        mesh->index_capacity = mesh->index_capacity ? 2 * mesh->index_capacity : 3 * BLOCK_SIZE;
+        mesh->indices = (uint32_t *)realloc(mesh->indices, mesh->index_capacity * sizeof(uint32_t));
+    }
+
+    uint32_t *index = &mesh->indices[mesh->index_count];
+    index[0] = a;
+    index[1] = b;
+    index[2] = c;
+    mesh->index_count += 3;
+}
+
+inline void CornerPosition(const vec3 center, float size, uint32_t corner, vec3 p)
+{
+    vec3_scale(p, CHILDREN_CENTER_OFFSET[corner], size);
+    vec3_add(p, center, p);
+}
+
+static void SampleLeaf(Octree *octree, NodeIndex node, const vec3 center, float size, DistanceFn distance, void *user)
+{
+    OctreeNode *n = GetNode(octree, node);
+    vec3 corners[8];
+    float d[8];
+    uint32_t inside = 0;
+
+    for (uint32_t i = 0; i < 8; ++i) {
+        CornerPosition(center, size, i, corners[i]);
+        d[i] = distance(corners[i], user);
+        inside |= (d[i] < 0) << i;
+    }
+
+    if (inside == 0 || inside == 0xff) {
+        n->value = inside ? 0xffff : 0;
+
+        if (n->data) {
+            FreeHermite(octree, n->data);
+            n->data = 0;
+        }
+
+        return;
+    }
+
+    n->value = 0xffff;
+    if (!n->data) {
+        n->data = AllocHermite(octree);
+    }
+
+    HermiteData *h = PoolGet(&octree->hermite, n->data);
+    memcpy(h->distance, d, sizeof(d));
+
+    float step = size * 1e-3f;
+
+    for (uint32_t e = 0; e < 12; ++e) {
+        uint32_t c0 = EDGE_CORNERS[e][0];
+        uint32_t c1 = EDGE_CORNERS[e][1];
+
+        if (((inside >> c0) ^ (inside >> c1)) & 1) {
+            float t = d[c0] / (d[c0] - d[c1]);
+            vec3 p, g;
+
+            for (size_t k = 0; k < 3; ++k) {
+                p[k] = corners[c0][k] + t * (corners[c1][k] - corners[c0][k]);
+            }
+
+            for (size_t k = 0; k < 3; ++k) {
+                vec3 a, b;
+                memcpy(a, p, sizeof(vec3));
+                memcpy(b, p, sizeof(vec3));
+                a[k] += step;
+                b[k] -= step;
+                g[k] = distance(a, user) - distance(b, user);
+            }
+
+            float len = vec3_len(g);
+            if (len > 0) {
+                vec3_scale(g, g, 1 / len);
+            }
+
+            h->crossing[e] = t;
+            memcpy(h->normals[e], g, sizeof(vec3));
+        }
+    }
+}
+
+static void SampleNode(Octree *octree, NodeIndex node, const vec3 center, float size, DistanceFn distance, void *user)
+{
+    if (!HasChildren(octree, node)) {
+        SampleLeaf(octree, node, center, size, distance, user);
+        return;
+    }
+
+    for (uint32_t i = 0; i < 8; ++i) {
+        vec3 c;
+        vec3_scale(c, CHILDREN_CENTER_OFFSET[i], size / 2);
+        vec3_add(c, center, c);
+
+        SampleNode(octree, GetNode(octree, node)->children[i], c, size / 2, distance, user);
+    }
+}
+
+//  Samples a signed distance function (negative inside) at the corners of
+//  every leaf. Leaves the surface passes through get Hermite data, with
+//  normals from central differences; the others become full or empty.
+//  Every leaf may change, so the whole tree is marked dirty.
+void SampleHermite(Octree *octree, DistanceFn distance, void *user)
+{
+    SampleNode(octree, 0, octree->center, octree->size, distance, user);
+    MarkDirty(octree, 0);
+}
+
+//  Point minimizing the squared distances to the planes through points[i]
+//  with normals[i], plus QEF_BIAS times the squared distance to their mass
+//  point. The bias stands in for the truncated SVD of the original paper:
+//  directions the planes don't pin down fall back to the mass point, and the
+//  system stays positive definite, so it is solved in closed form. The
+//  result is clamped to [min, max].
+void SolveQEF(const vec3 *points, const vec3 *normals, size_t count, const vec3 min, const vec3 max, vec3 x)
+{
+    vec3 mass = {0, 0, 0};
+    for (size_t i = 0; i < count; ++i) {
+        vec3_add(mass, mass, points[i]);
+    }
+    vec3_scale(mass, mass, 1.0f / count);
+
+    float bias = QEF_BIAS * count;
+    float a = bias, b = 0, c = 0, d = bias, e = 0, f = bias;
+    vec3 r = {0, 0, 0};
+
+    for (size_t i = 0; i < count; ++i) {
+        const float *n = normals[i];
+        vec3 offset;
+        vec3_sub(offset, points[i], mass);
+        float w = vec3_mul_dot(n, offset);
+
+        a += n[0] * n[0];
+        b += n[0] * n[1];
+        c += n[0] * n[2];
+        d += n[1] * n[1];
+        e += n[1] * n[2];
+        f += n[2] * n[2];
+
+        r[0] += n[0] * w;
+        r[1] += n[1] * w;
+        r[2] += n[2] * w;
+    }
+
+    //  Cofactors of the symmetric matrix [a b c; b d e; c e f].
+    float ca = d * f - e * e;
+    float cb = c * e - b * f;
+    float cc = b * e - c * d;
+    float cd = a * f - c * c;
+    float ce = b * c - a * e;
+    float cf = a * d - b * b;
+    float inv = 1 / (a * ca + b * cb + c * cc);
+
+    x[0] = mass[0] + (ca * r[0] + cb * r[1] + cc * r[2]) * inv;
+    x[1] = mass[1] + (cb * r[0] + cd * r[1] + ce * r[2]) * inv;
+    x[2] = mass[2] + (cc * r[0] + ce * r[1] + cf * r[2]) * inv;
+
+    for (uint32_t k = 0; k < 3; ++k) {
+        x[k] = x[k] < min[k] ? min[k] : (x[k] > max[k] ? max[k] : x[k]);
+    }
+}
+
+static void ContourVertices(Octree *octree, NodeIndex node, const vec3 center, float size, Mesh *mesh)
+{
+    if (HasChildren(octree, node)) {
+        for (uint32_t i = 0; i < 8; ++i) {
+            vec3 c;
+            vec3_scale(c, CHILDREN_CENTER_OFFSET[i], size / 2);
+            vec3_add(c, center, c);
+
+            ContourVertices(octree, GetNode(octree, node)->children[i], c, size / 2, mesh);
+        }
+
+        return;
+    }
+
+    HermiteData *h = GetHermite(octree, node);
+    if (!h) {
+        return;
+    }
+
+    vec3 corners[8];
+    for (uint32_t i = 0; i < 8; ++i) {
+        CornerPosition(center, size, i, corners[i]);
+    }
+
+    vec3 points[12];
+    vec3 normals[12];
+    size_t count = 0;
+
+    for (uint32_t e = 0; e < 12; ++e) {
+        uint32_t c0 = EDGE_CORNERS[e][0];
+        uint32_t c1 = EDGE_CORNERS[e][1];
+
+        if ((h->distance[c0] < 0) != (h->distance[c1] < 0)) {
+            float t = h->crossing[e];
+
+            for (size_t k = 0; k < 3; ++k) {
+                points[count][k] = corners[c0][k] + t * (corners[c1][k] - corners[c0][k]);
+            }
+
+            memcpy(normals[count++], h->normals[e], sizeof(vec3));
+        }
+    }
+
+    vec3 min, max, x;
+    for (size_t k = 0; k < 3; ++k) {
+        min[k] = center[k] - size / 2;
+        max[k] = center[k] + size / 2;
+    }
+
+    SolveQEF(points, normals, count, min, max, x);
+    h->vertex = MeshPushVertex(mesh, x);
+}
+
+//  Child of `node` at index i, or the node itself once it is a leaf.
+inline OctreeNode * ContourChild(Octree *octree, OctreeNode *node, bool leaf, uint32_t i)
+{
+    return leaf ? node : GetNode(octree, node->children[i]);
+}
+
+//  Emits the quad around a minimal edge along `axis`. The deepest of the
+//  four leaves owns the edge, so its corner signs decide. All four leaves
+//  have Hermite data, or EdgeProc would not have got here.
+static void ProcessEdge(Octree *octree, OctreeNode *const nodes[4], const uint16_t depths[4], uint32_t axis, Mesh *mesh)
+{
+    uint32_t owner = 0;
+    for (uint32_t q = 1; q < 4; ++q) {
+        if (depths[q] > depths[owner]) {
+            owner = q;
+        }
+    }
+
+    HermiteData *h = PoolGet(&octree->hermite, nodes[owner]->data);
+    uint32_t u = EDGE_AXES[axis][0];
+    uint32_t v = EDGE_AXES[axis][1];
+    uint32_t c0 = (1 - QUAD_SIDES[owner][0]) << u | (1 - QUAD_SIDES[owner][1]) << v;
+    uint32_t c1 = c0 | 1 << axis;
+
+    bool inside = h->distance[c0] < 0;
+    if (inside == (h->distance[c1] < 0)) {
+        return;
+    }
+
+    uint32_t index[4];
+    for (uint32_t q = 0; q < 4; ++q) {
+        index[q] = PoolGet(&octree->hermite, nodes[q]->data)->vertex;
+    }
+
+    if ((inside ? 1 : -1) == QUAD_WINDING[axis]) {
+        MeshPushTriangle(mesh, index[0], index[1], index[2]);
+        MeshPushTriangle(mesh, index[0], index[2], index[3]);
+    } else {
+        MeshPushTriangle(mesh, index[0], index[2], index[1]);
+        MeshPushTriangle(mesh, index[0], index[3], index[2]);
+    }
+}
+
+//  Four cells around an edge along `axis`, in QUAD_SIDES order. A quad
+//  needs a vertex in all four cells, so a leaf without Hermite data ends
+//  the walk.
+static void EdgeProc(Octree *octree, OctreeNode *const nodes[4], const uint16_t depths[4], uint32_t axis, Mesh *mesh)
+{
+    bool leaf[4];
+    bool leaves = true;
+
+    for (uint32_t q = 0; q < 4; ++q) {
+        leaf[q] = !HasChildren(nodes[q]);
+
+        if (leaf[q] && !nodes[q]->data) {
+            return;
+        }
+
+        leaves &= leaf[q];
+    }
+
+    if (leaves) {
+        ProcessEdge(octree, nodes, depths, axis, mesh);
+        return;
+    }
+
+    uint32_t u = EDGE_AXES[axis][0];
+    uint32_t v = EDGE_AXES[axis][1];
+
+    for (uint32_t half = 0; half < 2; ++half) {
+        OctreeNode *sub[4];
+        uint16_t sub_depths[4];
+
+        for (uint32_t q = 0; q < 4; ++q) {
+            uint32_t i = half << axis | (1 - QUAD_SIDES[q][0]) << u | (1 - QUAD_SIDES[q][1]) << v;
+            sub[q] = ContourChild(octree, nodes[q], leaf[q], i);
+            sub_depths[q] = depths[q] + !leaf[q];
+        }
+
+        EdgeProc(octree, sub, sub_depths, axis, mesh);
+    }
+}
+
+//  Two cells sharing a face across `axis`, the low one first.
+static void FaceProc(Octree *octree, OctreeNode *const nodes[2], const uint16_t depths[2], uint32_t axis, Mesh *mesh)
+{
+    bool leaf[2] = {!HasChildren(nodes[0]), !HasChildren(nodes[1])};
+
+    if ((leaf[0] && leaf[1]) || (leaf[0] && !nodes[0]->data) || (leaf[1] && !nodes[1]->data)) {
+        return;
+    }
+
+    uint32_t bit = 1 << axis;
+    uint16_t sub_depths[2] = {uint16_t(depths[0] + !leaf[0]), uint16_t(depths[1] + !leaf[1])};
+
+    for (uint32_t i = 0; i < 8; ++i) {
+        if (i & bit) {
+            continue;
+        }
+
+        OctreeNode *sub[2] = {
+            ContourChild(octree, nodes[0], leaf[0], i | bit),
+            ContourChild(octree, nodes[1], leaf[1], i)
+        };
+
+        FaceProc(octree, sub, sub_depths, axis, mesh);
+    }
+
+    //  Edges inside the face run along the two other axes.
+    for (uint32_t edge = 0; edge < 3; ++edge) {
+        if (edge == axis) {
+            continue;
+        }
+
+        uint32_t u = EDGE_AXES[edge][0];
+        uint32_t v = EDGE_AXES[edge][1];
+
+        for (uint32_t half = 0; half < 2; ++half) {
+            OctreeNode *sub[4];
+            uint16_t edge_depths[4];
+
+            for (uint32_t q = 0; q < 4; ++q) {
+                uint32_t su = QUAD_SIDES[q][0];
+                uint32_t sv = QUAD_SIDES[q][1];
+                uint32_t side = u == axis ? su : sv;
+                uint32_t i = half << edge | (u == axis ? 1 - su : su) << u | (v == axis ? 1 - sv : sv) << v;
+
+                sub[q] = ContourChild(octree, nodes[side], leaf[side], i);
+                edge_depths[q] = sub_depths[side];
+            }
+
+            EdgeProc(octree, sub, edge_depths, edge, mesh);
+        }
+    }
+}
+
+static void CellProc(Octree *octree, OctreeNode *node, uint16_t depth, Mesh *mesh)
+{
+    if (!HasChildren(node)) {
+        return;
+    }
+
+    OctreeNode *children[8];
+    for (uint32_t i = 0; i < 8; ++i) {
+        children[i] = GetNode(octree, node->children[i]);
+    }
+
+    uint16_t child_depth = depth + 1;
+
+    for (uint32_t i = 0; i < 8; ++i) {
+        CellProc(octree, children[i], child_depth, mesh);
+    }
+
+    uint16_t depths[4] = {child_depth, child_depth, child_depth, child_depth};
+
+    for (uint32_t axis = 0; axis < 3; ++axis) {
+        uint32_t bit = 1 << axis;
+
+        for (uint32_t i = 0; i < 8; ++i) {
+            if (!(i & bit)) {
+                OctreeNode *faces[2] = {children[i], children[i | bit]};
+                FaceProc(octree, faces, depths, axis, mesh);
+            }
+        }
+
+        uint32_t u = EDGE_AXES[axis][0];
+        uint32_t v = EDGE_AXES[axis][1];
+
+        for (uint32_t half = 0; half < 2; ++half) {
+            OctreeNode *edges[4];
+
+            for (uint32_t q = 0; q < 4; ++q) {
+                edges[q] = children[half << axis | QUAD_SIDES[q][0] << u | QUAD_SIDES[q][1] << v];
+            }
+
+            EdgeProc(octree, edges, depths, axis, mesh);
+        }
+    }
+}
+
+//  Replaces the contents of `mesh` with the surface through the Hermite data
+//  of the octree: one vertex per leaf with data, three indices per triangle.
+void Contour(Octree *octree, Mesh *mesh)
+{
+    mesh->vertex_count = 0;
+    mesh->index_count = 0;
+
+    ContourVertices(octree, 0, octree->center, octree->size, mesh);
+    CellProc(octree, GetNode(octree, 0), 0, mesh);
+}
+
+}
+
+#endif
@@ -0,0 +1,334 @@
+#ifndef OCTREE_DAG_H
+#define OCTREE_DAG_H
+
+#include <stdlib.h>
+
+#include "octree.h"
+#include "raycast.h"
+
+namespace Octree {
+
+//  Read-only sparse voxel DAG (Kämpe et al., "High Resolution Sparse Voxel
+//  DAGs"). Nodes are runs of words in one array. An inner node is a header
+//  holding the mask of its non-empty children, followed by the offset of
+//  each of them in child order; a leaf is a single header with DAG_LEAF set
+//  and the value in the low bits. Identical subtrees are stored once, inner
+//  nodes whose eight children are the same leaf become that leaf, and empty
+//  subtrees are left out of the masks.
+
+const uint32_t DAG_LEAF = 0x80000000u;
+const uint32_t DAG_EMPTY = 0xffffffffu;
+
+struct Dag {
+    vec3 center;
+    float size;
+    uint32_t *words;
+    size_t word_count;
+    uint32_t root;
+};
+
+//  Open addressing table from node contents to node offsets, used while
+//  building. Slots hold offset + 1, 0 is free.
+struct DagBuilder {
+    uint32_t *words;
+    size_t word_count;
+    size_t word_capacity;
+    uint32_t *table;
+    size_t table_size;
+    size_t entries;
+};
+
+inline uint32_t DagCountBits(uint32_t mask)
+{
+    mask = mask - ((mask >> 1) & 0x55);
+    mask = (mask & 0x33) + ((mask >> 2) & 0x33);
+    return (mask + (mask >> 4)) & 0x0f;
+}
+
+inline uint32_t DagNodeLength(uint32_t header)
+{
+    return header & DAG_LEAF ? 1 : 1 + DagCountBits(header & 0xff);
+}
+
+//  Offset of child i of an inner node; the child must be present.
+inline uint32_t DagChild(const uint32_t *words, uint32_t node, uint32_t i)
+{
+    uint32_t header = words[node];
+    return words[node + 1 + DagCountBits(header & ((1u << i) - 1))];
+}
+
+static uint32_t DagHash(const uint32_t *words, uint32_t length)
+{
+    uint32_t hash = 2166136261u;
+
+    for (uint32_t i = 0; i < length; ++i) {
+        hash = (hash ^ words[i]) * 16777619u;
+    }
+
+    return hash ^ (hash >> 15);
+}
+
+static void DagGrowTable(DagBuilder *builder)
+{
+    size_t size = builder->table_size ? 2 * builder->table_size : BLOCK_SIZE;
+    uint32_t *table = (uint32_t *)calloc(size, sizeof(uint32_t));
+
+    for (size_t i = 0; i < builder->table_size; ++i) {
+        uint32_t slot = builder->table[i];
+
+        if (slot) {
+            const uint32_t *node = &builder->words[slot - 1];
+            size_t j = DagHash(node, DagNodeLength(node[0])) & (size - 1);
+
+            while (table[j]) {
+                j = (j + 1) & (size - 1);
+            }
+
+            table[j] = slot;
+        }
+    }
+
+    free(builder->table);
+    builder->table = table;
+    builder->table_size = size;
+}
+
+//  Offset of the node with these words, appending it if it is new.
+static uint32_t DagInsert(DagBuilder *builder, const uint32_t *node, uint32_t length)
+{
+    if (2 * (builder->entries + 1) > builder->table_size) {
+        DagGrowTable(builder);
+    }
+
+    size_t mask = builder->table_size - 1;
+    size_t j = DagHash(node, length) & mask;
+
+    for (; builder->table[j]; j = (j + 1) & mask) {
+        const uint32_t *other = &builder->words[builder->table[j] - 1];
+
+        if (other[0] == node[0] && !memcmp(other, node, length * sizeof(uint32_t))) {
+            return builder->table[j] - 1;
+        }
+    }
+
+    if (builder->word_count + length > builder->word_capacity) {
+        builder->word_capacity = builder->word_capacity ? 2 * builder->word_capacity : BLOCK_SIZE;
+        builder->words = (uint32_t *)realloc(builder->words, builder->word_capacity * sizeof(uint32_t));
+    }
+
+    uint32_t offset = (uint32_t)builder->word_count;
+    assert(offset == builder->word_count && offset < DAG_EMPTY - 9);
+
+    memcpy(&builder->words[offset], node, length * sizeof(uint32_t));
+    builder->word_count += length;
+    builder->table[j] = offset + 1;
+    builder->entries++;
+
+    return offset;
+}
+
+static uint32_t DagConvert(Octree *octree, DagBuilder *builder, NodeIndex node)
+{
+    OctreeNode *n = GetNode(octree, node);
+
+    if (!HasChildren(n)) {
+        uint32_t leaf = DAG_LEAF | n->value;
+        return n->value ? DagInsert(builder, &leaf, 1) : DAG_EMPTY;
+    }
+
+    uint32_t children[8];
+    bool uniform = true;
+
+    for (uint32_t i = 0; i < 8; ++i) {
+        children[i] = DagConvert(octree, builder, n->children[i]);
+        uniform &= children[i] == children[0];
+    }
+
+    if (uniform && (children[0] == DAG_EMPTY || builder->words[children[0]] & DAG_LEAF)) {
+        return children[0];
+    }
+
+    uint32_t words[9];
+    uint32_t length = 1;
+    words[0] = 0;
+
+    for (uint32_t i = 0; i < 8; ++i) {
+        if (children[i] != DAG_EMPTY) {
+            words[0] |= 1 << i;
+            words[length++] = children[i];
+        }
+    }
+
+    return DagInsert(builder, words, length);
+}
+
+//  Converts an octree bottom-up, hashing every node once its children have
+//  their final offsets.
+void BuildDag(Dag *dag, Octree *octree)
+{
+    DagBuilder builder = {};
+
+    memcpy(dag->center, octree->center, sizeof(vec3));
+    dag->size = octree->size;
+    dag->root = DagConvert(octree, &builder, 0);
+    dag->word_count = builder.word_count;
+    dag->words = (uint32_t *)realloc(builder.words, (builder.word_count ? builder.word_count : 1) * sizeof(uint32_t));
+
+    free(builder.table);
+}
+
+size_t DagBytes(Dag *dag)
+{
+    return dag->word_count * sizeof(uint32_t);
+}
+
+//  Value of the leaf holding p, 0 when p is in an empty region or outside.
+NodeValue Lookup(Dag *dag, const vec3 p)
+{
+    float half = dag->size / 2;
+    for (size_t k = 0; k < 3; ++k) {
+        if (p[k] < dag->center[k] - half || p[k] > dag->center[k] + half) {
+            return 0;
+        }
+    }
+
+    vec3 c;
+    memcpy(c, dag->center, sizeof(vec3));
+    float scale = half / 2;
+    uint32_t node = dag->root;
+
+    while (node != DAG_EMPTY) {
+        uint32_t header = dag->words[node];
+
+        if (header & DAG_LEAF) {
+            return (NodeValue)header;
+        }
+
+        uint32_t i = ChildIndex(c, p);
+        if (!(header & (1 << i))) {
+            return 0;
+        }
+
+        vec3 offset;
+        vec3_scale(offset, CHILDREN_CENTER_OFFSET[i], 2 * scale);
+        vec3_add(c, c, offset);
+        scale *= 0.5f;
+
+        node = DagChild(dag->words, node, i);
+    }
+
+    return 0;
+}
+
+static void VisitDagNode(Dag *dag, uint32_t node, const vec3 center, float size, LeafFn fn, void *user)
+{
+    uint32_t header = dag->words[node];
+
+    if (header & DAG_LEAF) {
+        fn(center, size, (NodeValue)header, user);
+        return;
+    }
+
+    const uint32_t *child = &dag->words[node + 1];
+
+    for (uint32_t i = 0; i < 8; ++i) {
+        if (header & (1 << i)) {
+            vec3 c;
+            vec3_scale(c, CHILDREN_CENTER_OFFSET[i], size / 2);
+            vec3_add(c, center, c);
+
+            VisitDagNode(dag, *child++, c, size / 2, fn, user);
+        }
+    }
+}
+
+//  Calls fn on every non-empty leaf, expanding shared subtrees in place.
+void VisitLeaves(Dag *dag, LeafFn fn, void *user)
+{
+    if (dag->root != DAG_EMPTY) {
+        VisitDagNode(dag, dag->root, dag->center, dag->size, fn, user);
+    }
+}
+
+//  RayCast over the DAG, with the same traversal as the octree one. The
+//  node of the hit is the offset of the leaf.
+bool RayCast(Dag *dag, const vec3 origin, const vec3 dir, RayHit *hit)
+{
+    if (dag->root == DAG_EMPTY) {
+        return false;
+    }
+
+    float half = dag->size / 2;
+    vec3 inv, min, max;
+    float tmin, tmax;
+
+    ray_inverse(inv, dir);
+    for (size_t k = 0; k < 3; ++k) {
+        min[k] = dag->center[k] - half;
+        max[k] = dag->center[k] + half;
+    }
+
+    if (!intersect_aabb(origin, inv, min, max, &tmin, &tmax) || tmax < 0) {
+        return false;
+    }
+
+    RayFrame stack[MAX_DEPTH + 1];
+    RayFrame *top = stack;
+
+    top->node = dag->root;
+    top->child = RAY_ENTER;
+    uint32_t mask = RaySetup(dag->center, half, origin, dir, top->t0, top->t1);
+
+    for (;;) {
+        if (top->child == RAY_ENTER) {
+            top->child = RAY_DONE;
+
+            if (top->t1[0] < 0 || top->t1[1] < 0 || top->t1[2] < 0) {
+                // Behind the origin.
+            } else if (dag->words[top->node] & DAG_LEAF) {
+                RayReportHit(top->t0, dir, top->node, hit);
+                return true;
+            } else {
+                float tm[3];
+                for (uint32_t k = 0; k < 3; ++k) {
+                    tm[k] = 0.5f * (top->t0[k] + top->t1[k]);
+                }
+
+                top->child = RayFirstChild(top->t0, tm);
+            }
+        }
+
+        if (top->child == RAY_DONE) {
+            if (top == stack) {
+                return false;
+            }
+
+            --top;
+            continue;
+        }
+
+        RayFrame *next = top + 1;
+        uint32_t child = top->child;
+
+        RayChildSpan(top, child, next->t0, next->t1);
+        top->child = RayNextChild(child, next->t1);
+
+        if (dag->words[top->node] & (1 << (child ^ mask))) {
+            next->node = DagChild(dag->words, top->node, child ^ mask);
+            next->child = RAY_ENTER;
+            top = next;
+        }
+    }
+}
+
+void Cleanup(Dag *dag)
+{
+    free(dag->words);
+    dag->words = nullptr;
+    dag->word_count = 0;
+    dag->root = DAG_EMPTY;
+}
+
+}
+
+#endif
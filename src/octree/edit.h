@@ -0,0 +1,638 @@
+#ifndef OCTREE_EDIT_H
+#define OCTREE_EDIT_H
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "octree.h"
+#include "contour.h"
+
+namespace Octree {
+
+//  CSG brushes. Every brush shape has an exact signed distance (negative
+//  inside), so a node whose center is further from the brush surface than
+//  its half diagonal lies wholly on one side of it. An edit only descends
+//  into the nodes the brush surface passes through. Nodes wholly inside
+//  are filled, emptied or painted at once and collapse back into a single
+//  leaf, so the cost follows the area of the brush, not its volume. The
+//  descent keeps its own stack, so an edit too large for one frame can be
+//  spread over several with BeginBrush and ContinueBrush, and EditQueue
+//  does that on a private copy so readers only ever see whole edits.
+
+enum BrushShape {
+    BRUSH_SPHERE,
+    BRUSH_BOX,
+    BRUSH_CAPSULE
+};
+
+enum BrushOp {
+    BRUSH_ADD,
+    BRUSH_SUBTRACT,
+    BRUSH_PAINT
+};
+
+//  A sphere of `radius` around a, a box of half extents `extent` around a,
+//  or a capsule of `radius` around the segment from a to b. Leaves the
+//  brush adds or paints get `value`, which must not be 0.
+struct Brush {
+    BrushShape shape;
+    BrushOp op;
+    vec3 a;
+    vec3 b;
+    vec3 extent;
+    float radius;
+    NodeValue value;
+};
+
+//  Half the diagonal of a node, in node sizes.
+const float BRUSH_REACH = 0.8660254f;
+
+//  Signed distance from p to the brush surface, and its gradient in
+//  `normal` unless that is null. Runs for every corner an edit touches, so
+//  it sticks to scalar math the compiler keeps in registers.
+inline float BrushDistance(const Brush *brush, const vec3 p, float *normal)
+{
+    float x = p[0] - brush->a[0];
+    float y = p[1] - brush->a[1];
+    float z = p[2] - brush->a[2];
+
+    if (brush->shape == BRUSH_BOX) {
+        float qx = fabsf(x) - brush->extent[0];
+        float qy = fabsf(y) - brush->extent[1];
+        float qz = fabsf(z) - brush->extent[2];
+        float ox = qx > 0 ? qx : 0;
+        float oy = qy > 0 ? qy : 0;
+        float oz = qz > 0 ? qz : 0;
+        float outside = sqrtf(ox * ox + oy * oy + oz * oz);
+        float inside = qx > qy ? (qx > qz ? qx : qz) : (qy > qz ? qy : qz);
+
+        if (normal) {
+            if (outside > 0) {
+                normal[0] = copysignf(ox / outside, x);
+                normal[1] = copysignf(oy / outside, y);
+                normal[2] = copysignf(oz / outside, z);
+            } else {
+                normal[0] = inside == qx ? copysignf(1, x) : 0;
+                normal[1] = inside == qy && inside != qx ? copysignf(1, y) : 0;
+                normal[2] = inside == qz && inside != qx && inside != qy ? copysignf(1, z) : 0;
+            }
+        }
+
+        return outside > 0 ? outside : inside;
+    }
+
+    if (brush->shape == BRUSH_CAPSULE) {
+        float bx = brush->b[0] - brush->a[0];
+        float by = brush->b[1] - brush->a[1];
+        float bz = brush->b[2] - brush->a[2];
+        float len = bx * bx + by * by + bz * bz;
+        float h = len > 0 ? (x * bx + y * by + z * bz) / len : 0;
+        h = h < 0 ? 0 : (h > 1 ? 1 : h);
+
+        x -= h * bx;
+        y -= h * by;
+        z -= h * bz;
+    }
+
+    float len = sqrtf(x * x + y * y + z * z);
+
+    if (normal) {
+        float inv = len > 0 ? 1 / len : 0;
+        normal[0] = x * inv;
+        normal[1] = len > 0 ? y * inv : 1;
+        normal[2] = z * inv;
+    }
+
+    return len - brush->radius;
+}
+
+//  Applies the brush to a leaf at its own size. Corner distances become the
+//  union (add) or difference (subtract) of the old ones and the brush. A
+//  leaf without Hermite data stands for a field of -size or size, which has
+//  the right sign and is further than any of its corners can be from the
+//  surface. Each edge that changes sign keeps the crossing of whichever
+//  surface bounds the result there, with its normal. `b` holds the brush
+//  distances at the corners.
+static void EditLeaf(Octree *octree, NodeIndex node, const vec3 center, float size, const Brush *brush, const float *b)
+{
+    OctreeNode *n = GetNode(octree, node);
+
+    if (brush->op == BRUSH_PAINT) {
+        bool touched = false;
+
+        for (uint32_t i = 0; i < 8; ++i) {
+            touched |= b[i] < 0;
+        }
+
+        if (touched && n->value && n->value != brush->value) {
+            n->value = brush->value;
+            MarkDirty(octree, node);
+        }
+
+        return;
+    }
+
+    float old[8];
+    float crossing[12];
+    vec3 normals[12];
+    uint32_t old_inside = 0;
+
+    if (n->data) {
+        HermiteData *h = PoolGet(&octree->hermite, n->data);
+        memcpy(old, h->distance, sizeof(old));
+        memcpy(crossing, h->crossing, sizeof(crossing));
+        memcpy(normals, h->normals, sizeof(normals));
+    } else {
+        for (uint32_t i = 0; i < 8; ++i) {
+            old[i] = n->value ? -size : size;
+        }
+    }
+
+    bool add = brush->op == BRUSH_ADD;
+    float d[8];
+    uint32_t inside = 0;
+    uint32_t brush_inside = 0;
+
+    for (uint32_t i = 0; i < 8; ++i) {
+        if (add) {
+            d[i] = b[i] < old[i] ? b[i] : old[i];
+        } else {
+            d[i] = -b[i] > old[i] ? -b[i] : old[i];
+        }
+
+        old_inside |= (old[i] < 0) << i;
+        inside |= (d[i] < 0) << i;
+        brush_inside |= (b[i] < 0) << i;
+    }
+
+    //  What the brush covers takes its value, the rest keeps the old one.
+    NodeValue value = add && brush_inside == 0xff ? brush->value : (n->value ? n->value : brush->value);
+
+    if (inside == 0 || inside == 0xff) {
+        value = inside ? value : 0;
+
+        if (n->data || n->value != value) {
+            if (n->data) {
+                FreeHermite(octree, n->data);
+                n->data = 0;
+            }
+
+            n->value = value;
+            MarkDirty(octree, node);
+        }
+
+        return;
+    }
+
+    if (!n->data) {
+        n->data = AllocHermite(octree);
+    }
+
+    n->value = value;
+
+    HermiteData *h = PoolGet(&octree->hermite, n->data);
+    memcpy(h->distance, d, sizeof(d));
+
+    for (uint32_t e = 0; e < 12; ++e) {
+        uint32_t c0 = EDGE_CORNERS[e][0];
+        uint32_t c1 = EDGE_CORNERS[e][1];
+
+        if (!(((inside >> c0) ^ (inside >> c1)) & 1)) {
+            continue;
+        }
+
+        //  The result changes sign at the first crossing seen from the
+        //  corner outside the union, or inside the difference.
+        bool from_c0 = ((inside >> c0) & 1) != add;
+        bool has_old = ((old_inside >> c0) ^ (old_inside >> c1)) & 1;
+        bool has_brush = (b[c0] < 0) != (b[c1] < 0);
+        float t = has_old ? crossing[e] : 0;
+
+        if (has_brush) {
+            float tb = b[c0] / (b[c0] - b[c1]);
+
+            if (!has_old || (from_c0 ? tb < t : tb > t)) {
+                vec3 p, g, p1;
+                CornerPosition(center, size, c0, p);
+                CornerPosition(center, size, c1, p1);
+
+                for (uint32_t k = 0; k < 3; ++k) {
+                    p[k] += tb * (p1[k] - p[k]);
+                }
+
+                BrushDistance(brush, p, g);
+                vec3_scale(normals[e], g, add ? 1.0f : -1.0f);
+                t = tb;
+            }
+        }
+
+        h->crossing[e] = t;
+        memcpy(h->normals[e], normals[e], sizeof(vec3));
+    }
+
+    MarkDirty(octree, node);
+}
+
+//  A node wholly inside the brush becomes a single full or empty leaf, or
+//  has every solid leaf below it painted, collapsing what became uniform.
+static void FillNode(Octree *octree, NodeIndex node, const Brush *brush)
+{
+    OctreeNode *n = GetNode(octree, node);
+
+    if (brush->op == BRUSH_PAINT) {
+        if (HasChildren(n)) {
+            for (size_t i = 0; i < 8; ++i) {
+                FillNode(octree, n->children[i], brush);
+            }
+
+            CollapseNode(octree, node);
+        } else if (n->value && n->value != brush->value) {
+            n->value = brush->value;
+            MarkDirty(octree, node);
+        }
+
+        return;
+    }
+
+    NodeValue value = brush->op == BRUSH_ADD ? brush->value : 0;
+
+    if (!HasChildren(n) && !n->data && n->value == value) {
+        return;
+    }
+
+    if (HasChildren(n)) {
+        FreeChildren(octree, node);
+
+        // Nothing is left below to be dirty.
+        n->flags = 0;
+    }
+
+    if (n->data) {
+        FreeHermite(octree, n->data);
+        n->data = 0;
+    }
+
+    n->value = value;
+    MarkDirty(octree, node);
+}
+
+//  Brush distance at the 27 corners of the children of a node, indexed by
+//  bit space position 0, 1 or 2 along x, then y, then z, so that children
+//  edited as leaves share corners instead of each evaluating its own eight.
+static void BrushLattice(const Brush *brush, const vec3 center, float size, float lattice[27])
+{
+    float half = size / 2;
+
+    for (uint32_t u = 0; u < 27; ++u) {
+        vec3 p = {
+            center[0] - half + (u % 3) * half,
+            center[1] + half - (u / 3 % 3) * half,
+            center[2] - half + (u / 9) * half
+        };
+
+        lattice[u] = BrushDistance(brush, p, nullptr);
+    }
+}
+
+inline uint32_t LatticeCorner(uint32_t child, uint32_t corner)
+{
+    return ((child & 1) + (corner & 1))
+        + 3 * ((child >> 1 & 1) + (corner >> 1 & 1))
+        + 9 * ((child >> 2 & 1) + (corner >> 2 & 1));
+}
+
+//  A node whose children an edit is visiting, the next child to visit and,
+//  when the children are leaves at full depth, the brush at their corners.
+struct BrushFrame {
+    NodeIndex node;
+    vec3 center;
+    float size;
+    uint16_t depth;
+    uint8_t next;
+    bool leaves;
+    float lattice[27];
+};
+
+//  An edit in progress. The stack holds the path from the root down to the
+//  node being visited, so an edit can stop after any node and pick up
+//  there later.
+struct BrushEdit {
+    Brush brush;
+    uint16_t max_depth;
+    uint32_t top;
+    BrushFrame stack[MAX_DEPTH + 2];
+};
+
+//  Edits the node in `frame` as far as it can without its children.
+//  Returns true when the children still need the brush, with the frame set
+//  up to visit them. `corners` holds the brush at the corners of the node
+//  when its parent already had them, and is null otherwise.
+static bool EnterNode(Octree *octree, BrushFrame *frame, const Brush *brush, uint16_t max_depth, const float *corners)
+{
+    NodeIndex node = frame->node;
+    OctreeNode *n = GetNode(octree, node);
+
+    // A leaf at full depth only changes where its corners do.
+    if (corners && !HasChildren(n)) {
+        EditLeaf(octree, node, frame->center, frame->size, brush, corners);
+        return false;
+    }
+
+    float distance = BrushDistance(brush, frame->center, nullptr);
+    float reach = frame->size * BRUSH_REACH;
+
+    if (distance > reach) {
+        return false;
+    }
+
+    if (distance < -reach) {
+        FillNode(octree, node, brush);
+        return false;
+    }
+
+    n = GetNode(octree, node);
+
+    if (!HasChildren(n) && (frame->depth >= max_depth || n->data)) {
+        float b[8];
+
+        for (uint32_t i = 0; i < 8; ++i) {
+            vec3 p;
+            CornerPosition(frame->center, frame->size, i, p);
+            b[i] = BrushDistance(brush, p, nullptr);
+        }
+
+        EditLeaf(octree, node, frame->center, frame->size, brush, b);
+        return false;
+    }
+
+    frame->leaves = frame->depth + 1 >= max_depth;
+    frame->next = 0;
+
+    if (frame->leaves) {
+        BrushLattice(brush, frame->center, frame->size, frame->lattice);
+    }
+
+    if (!HasChildren(n)) {
+        // Adding what a leaf already holds or taking from an empty one
+        // changes nothing.
+        if (brush->op == BRUSH_ADD ? n->value == brush->value : n->value == 0) {
+            return false;
+        }
+
+        //  Leaves at full depth only see the brush at their corners, so
+        //  when the brush covers none or all of them the leaf stays whole.
+        if (frame->leaves) {
+            uint32_t covered = 0;
+
+            for (uint32_t u = 0; u < 27; ++u) {
+                covered += frame->lattice[u] < 0;
+            }
+
+            if (covered == 0) {
+                return false;
+            }
+
+            if (covered == 27) {
+                FillNode(octree, node, brush);
+                return false;
+            }
+        }
+
+        SplitLeaf(octree, node);
+    }
+
+    return true;
+}
+
+//  Starts an edit that ContinueBrush carries out. Until it finishes the
+//  tree may be read, but not edited any other way.
+void BeginBrush(Octree *octree, BrushEdit *edit, const Brush *brush, uint16_t max_depth)
+{
+    assert(max_depth <= MAX_DEPTH && (brush->op == BRUSH_SUBTRACT || brush->value));
+
+    edit->brush = *brush;
+    edit->max_depth = max_depth;
+
+    BrushFrame *root = &edit->stack[0];
+    root->node = 0;
+    memcpy(root->center, octree->center, sizeof(vec3));
+    root->size = octree->size;
+    root->depth = 0;
+
+    edit->top = EnterNode(octree, root, &edit->brush, max_depth, nullptr) ? 1 : 0;
+}
+
+//  Visits up to `budget` more nodes of an edit, so a large brush can be
+//  spread over several frames. Returns true once the edit is done. Nodes
+//  split on the way collapse again as the edit leaves them.
+bool ContinueBrush(Octree *octree, BrushEdit *edit, size_t budget)
+{
+    while (edit->top) {
+        BrushFrame *frame = &edit->stack[edit->top - 1];
+
+        if (frame->next == 8) {
+            CollapseNode(octree, frame->node);
+            edit->top--;
+            continue;
+        }
+
+        if (!budget) {
+            return false;
+        }
+
+        budget--;
+
+        uint32_t i = frame->next++;
+        BrushFrame *child = &edit->stack[edit->top];
+
+        vec3_scale(child->center, CHILDREN_CENTER_OFFSET[i], frame->size / 2);
+        vec3_add(child->center, frame->center, child->center);
+        child->node = GetNode(octree, frame->node)->children[i];
+        child->size = frame->size / 2;
+        child->depth = frame->depth + 1;
+
+        float corners[8];
+
+        if (frame->leaves) {
+            for (uint32_t j = 0; j < 8; ++j) {
+                corners[j] = frame->lattice[LatticeCorner(i, j)];
+            }
+        }
+
+        if (EnterNode(octree, child, &edit->brush, edit->max_depth, frame->leaves ? corners : nullptr)) {
+            assert(edit->top + 1 < MAX_DEPTH + 2);
+            edit->top++;
+        }
+    }
+
+    return true;
+}
+
+//  Adds, subtracts or paints a brush, splitting leaves the brush surface
+//  passes through down to max_depth. Those leaves get Hermite data for the
+//  edited surface, ready for Contour. Leaves that already have Hermite data
+//  are edited at their own size, since splitting them would lose the
+//  surface they hold.
+void ApplyBrush(Octree *octree, const Brush *brush, uint16_t max_depth)
+{
+    BrushEdit edit;
+    BeginBrush(octree, &edit, brush, max_depth);
+    ContinueBrush(octree, &edit, SIZE_MAX);
+}
+
+struct QueuedBrush {
+    Brush brush;
+    uint16_t max_depth;
+};
+
+//  Copying a node costs about a tenth of visiting one, so a frame's edit
+//  budget also pays for copying this many bytes of the tree.
+const size_t EDIT_COPY_BYTES = 256;
+
+//  Brush edits spread over several calls without readers ever seeing one
+//  half done. Each edit runs on `work`, a copy of `shown` made a slice at
+//  a time first, and the two swap when it finishes, so `shown` changes in
+//  one step. Brushes submitted meanwhile wait their turn in a ring that
+//  grows as needed. `editing` is set from the start of the copy until the
+//  edit is published.
+struct EditQueue {
+    Octree *shown;
+    Octree *work;
+    BrushEdit edit;
+    QueuedBrush current;
+    bool editing;
+    bool copying;
+    size_t copied;
+    QueuedBrush *pending;
+    uint32_t head;
+    uint32_t count;
+    uint32_t capacity;
+};
+
+//  `shown` is the tree to edit, `spare` an initialised tree the queue
+//  keeps the copy in. Which of the two is shown changes with every edit.
+void EditQueueInit(EditQueue *queue, Octree *shown, Octree *spare)
+{
+    queue->shown = shown;
+    queue->work = spare;
+    queue->editing = false;
+    queue->copying = false;
+    queue->copied = 0;
+    queue->pending = nullptr;
+    queue->head = 0;
+    queue->count = 0;
+    queue->capacity = 0;
+}
+
+void SubmitBrush(EditQueue *queue, const Brush *brush, uint16_t max_depth)
+{
+    if (queue->count == queue->capacity) {
+        uint32_t capacity = queue->capacity ? 2 * queue->capacity : 8;
+        QueuedBrush *pending = (QueuedBrush *)malloc(capacity * sizeof(QueuedBrush));
+
+        for (uint32_t i = 0; i < queue->count; ++i) {
+            pending[i] = queue->pending[(queue->head + i) % queue->capacity];
+        }
+
+        free(queue->pending);
+        queue->pending = pending;
+        queue->head = 0;
+        queue->capacity = capacity;
+    }
+
+    queue->pending[(queue->head + queue->count++) % queue->capacity] = {*brush, max_depth};
+}
+
+//  Copies up to `*bytes` more of the shown tree into the work tree, nodes
+//  first and then Hermite data, taking what it used off `*bytes`. Returns
+//  true once the copy is whole.
+static bool CopyShown(EditQueue *queue, size_t *bytes)
+{
+    Octree *src = queue->shown;
+    size_t node_count = (size_t)src->used + 1;
+    size_t hermite_count = src->hermite_used ? (size_t)src->hermite_used + 1 : 0;
+
+    if (queue->copied < node_count) {
+        size_t n = node_count - queue->copied;
+        size_t fit = *bytes / sizeof(OctreeNode);
+        n = n < fit ? n : fit;
+
+        PoolCopy(&queue->work->nodes, &src->nodes, queue->copied, n);
+        queue->copied += n;
+        *bytes -= n * sizeof(OctreeNode);
+
+        if (queue->copied < node_count) {
+            return false;
+        }
+    }
+
+    size_t done = queue->copied - node_count;
+    size_t n = hermite_count - done;
+    size_t fit = *bytes / sizeof(HermiteData);
+    n = n < fit ? n : fit;
+
+    PoolCopy(&queue->work->hermite, &src->hermite, done, n);
+    queue->copied += n;
+    *bytes -= n * sizeof(HermiteData);
+
+    if (done + n < hermite_count) {
+        return false;
+    }
+
+    CopyFields(queue->work, src);
+    return true;
+}
+
+//  Spends up to `budget` node visits on the edit in progress, starting the
+//  next queued one first if there is none. Returns the tree to read from,
+//  which is the other one once an edit finishes. The next edit starts on
+//  the following call, so readers see every edit before it is copied.
+Octree * UpdateEdits(EditQueue *queue, size_t budget)
+{
+    if (!queue->editing) {
+        if (!queue->count) {
+            return queue->shown;
+        }
+
+        queue->current = queue->pending[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+        queue->editing = true;
+        queue->copying = true;
+        queue->copied = 0;
+    }
+
+    if (queue->copying) {
+        size_t bytes = budget * EDIT_COPY_BYTES;
+
+        if (!CopyShown(queue, &bytes)) {
+            return queue->shown;
+        }
+
+        BeginBrush(queue->work, &queue->edit, &queue->current.brush, queue->current.max_depth);
+        queue->copying = false;
+        budget = bytes / EDIT_COPY_BYTES;
+    }
+
+    if (ContinueBrush(queue->work, &queue->edit, budget)) {
+        Octree *shown = queue->work;
+        queue->work = queue->shown;
+        queue->shown = shown;
+        queue->editing = false;
+    }
+
+    return queue->shown;
+}
+
+//  Frees the queue, not the trees.
+void EditQueueCleanup(EditQueue *queue)
+{
+    free(queue->pending);
+    queue->pending = nullptr;
+    queue->count = 0;
+    queue->capacity = 0;
+}
+
+}
+
+#endif
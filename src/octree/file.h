@@ -0,0 +1,233 @@
+#ifndef OCTREE_FILE_H
+#define OCTREE_FILE_H
+
+#include <stdio.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "octree.h"
+
+namespace Octree {
+
+//  On-disk octree. A header is followed by the node array and the Hermite
+//  data array, each a flat array in index order starting on a page
+//  boundary, which is exactly the layout Pool uses in memory. Opening a file
+//  maps it and points the pools into the mapping, so nothing is parsed and
+//  pages come in as the tree is walked.
+//
+//  The mapping is copy-on-write: nodes can be edited in place (dirty flags,
+//  values, Hermite data) but changes never reach the file. A tree that
+//  grows copies the pool that grew out of the mapping first.
+//
+//  The free lists live in the nodes and Hermite slots themselves, so only
+//  their heads go in the header, and freed nodes are reused after a reopen.
+
+const uint32_t FILE_MAGIC = 0x4654434f; // "OCTF"
+const uint32_t FILE_VERSION = 2;
+const uint64_t FILE_ALIGNMENT = 4096;
+
+struct FileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t index_size;
+    uint32_t node_size;
+    uint32_t hermite_size;
+    float center[3];
+    float size;
+    uint32_t reserved;
+    uint64_t node_count;
+    uint64_t hermite_count;
+    uint64_t node_offset;
+    uint64_t hermite_offset;
+    uint64_t free_nodes;
+    uint64_t free_count;
+    uint64_t free_hermite;
+};
+
+struct OctreeFile {
+    Octree octree;
+    void *base;
+    size_t length;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int fd;
+#endif
+};
+
+inline uint64_t FileAlign(uint64_t offset)
+{
+    return (offset + FILE_ALIGNMENT - 1) & ~(FILE_ALIGNMENT - 1);
+}
+
+static bool FilePad(FILE *file, uint64_t offset)
+{
+    static const char zeros[FILE_ALIGNMENT] = {};
+    uint64_t pad = FileAlign(offset) - offset;
+
+    return fwrite(zeros, 1, pad, file) == pad;
+}
+
+bool SaveOctree(Octree *octree, const char *path)
+{
+    FileHeader header = {};
+    header.magic = FILE_MAGIC;
+    header.version = FILE_VERSION;
+    header.index_size = sizeof(NodeIndex);
+    header.node_size = sizeof(OctreeNode);
+    header.hermite_size = sizeof(HermiteData);
+    memcpy(header.center, octree->center, sizeof(vec3));
+    header.size = octree->size;
+    header.node_count = (uint64_t)octree->used + 1;
+    header.hermite_count = octree->hermite_used ? (uint64_t)octree->hermite_used + 1 : 0;
+    header.node_offset = FileAlign(sizeof(FileHeader));
+    header.hermite_offset = FileAlign(header.node_offset + header.node_count * sizeof(OctreeNode));
+    header.free_nodes = octree->free_nodes;
+    header.free_count = octree->free_count;
+    header.free_hermite = octree->free_hermite;
+
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+        && FilePad(file, sizeof(header))
+        && PoolWrite(&octree->nodes, header.node_count, file)
+        && FilePad(file, header.node_offset + header.node_count * sizeof(OctreeNode))
+        && PoolWrite(&octree->hermite, header.hermite_count, file);
+
+    return fclose(file) == 0 && ok;
+}
+
+static void * MapFile(OctreeFile *file, const char *path)
+{
+#ifdef _WIN32
+    file->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file->file == INVALID_HANDLE_VALUE) {
+        return nullptr;
+    }
+
+    LARGE_INTEGER length;
+    GetFileSizeEx(file->file, &length);
+    file->length = (size_t)length.QuadPart;
+
+    file->mapping = CreateFileMappingA(file->file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+    if (!file->mapping) {
+        CloseHandle(file->file);
+        return nullptr;
+    }
+
+    void *base = MapViewOfFile(file->mapping, FILE_MAP_COPY, 0, 0, 0);
+    if (!base) {
+        CloseHandle(file->mapping);
+        CloseHandle(file->file);
+    }
+
+    return base;
+#else
+    file->fd = open(path, O_RDONLY);
+    if (file->fd < 0) {
+        return nullptr;
+    }
+
+    struct stat st;
+    if (fstat(file->fd, &st) != 0 || st.st_size == 0) {
+        close(file->fd);
+        return nullptr;
+    }
+
+    file->length = (size_t)st.st_size;
+
+    void *base = mmap(nullptr, file->length, PROT_READ | PROT_WRITE, MAP_PRIVATE, file->fd, 0);
+    if (base == MAP_FAILED) {
+        close(file->fd);
+        return nullptr;
+    }
+
+    return base;
+#endif
+}
+
+static void UnmapFile(OctreeFile *file)
+{
+#ifdef _WIN32
+    UnmapViewOfFile(file->base);
+    CloseHandle(file->mapping);
+    CloseHandle(file->file);
+#else
+    munmap(file->base, file->length);
+    close(file->fd);
+#endif
+    file->base = nullptr;
+}
+
+//  Maps a file written by SaveOctree. Fails on a missing file, another
+//  version or a build with a different node layout.
+bool OpenOctree(OctreeFile *file, const char *path)
+{
+    file->base = MapFile(file, path);
+    if (!file->base) {
+        return false;
+    }
+
+    FileHeader *header = (FileHeader *)file->base;
+    bool valid = file->length >= sizeof(FileHeader)
+        && header->magic == FILE_MAGIC
+        && header->version == FILE_VERSION
+        && header->index_size == sizeof(NodeIndex)
+        && header->node_size == sizeof(OctreeNode)
+        && header->hermite_size == sizeof(HermiteData)
+        && header->node_count >= 1
+        && header->node_offset + header->node_count * sizeof(OctreeNode) <= file->length
+        && header->hermite_offset + header->hermite_count * sizeof(HermiteData) <= file->length
+        && header->free_nodes < header->node_count
+        && header->free_count < header->node_count
+        && (header->free_hermite == 0 || header->free_hermite < header->hermite_count);
+
+    if (!valid) {
+        UnmapFile(file);
+        return false;
+    }
+
+    Octree *octree = &file->octree;
+    char *base = (char *)file->base;
+
+    memcpy(octree->center, header->center, sizeof(vec3));
+    octree->size = header->size;
+    octree->used = (NodeIndex)(header->node_count - 1);
+    octree->hermite_used = header->hermite_count ? (NodeIndex)(header->hermite_count - 1) : 0;
+    octree->free_nodes = (NodeIndex)header->free_nodes;
+    octree->free_count = (NodeIndex)header->free_count;
+    octree->free_hermite = (NodeIndex)header->free_hermite;
+    octree->generation = 1;
+
+    PoolMap(&octree->nodes, (OctreeNode *)(base + header->node_offset), header->node_count);
+    PoolMap(&octree->hermite, (HermiteData *)(base + header->hermite_offset), header->hermite_count);
+
+    return true;
+}
+
+void CloseOctree(OctreeFile *file)
+{
+    Cleanup(&file->octree);
+    UnmapFile(file);
+}
+
+}
+
+#endif
@@ -2,10 +2,11 @@
 #define OCTREE_OCTREE_H
 
 #include <stdint.h>
-#include <queue>
 #include <linmath.h>
 #include <fmt/core.h>
 
+#include "pool.h"
+
 namespace Octree {
 
 //         Points and regions
@@ -25,37 +26,85 @@ namespace Octree {
 //   |/                  |/
 //   4-------------------5
 
-const int BLOCK_SIZE = 1024;
+#ifndef OCTREE_INDEX_TYPE
+#define OCTREE_INDEX_TYPE uint32_t
+#endif
+
+typedef OCTREE_INDEX_TYPE NodeIndex;
+typedef uint16_t NodeValue;
+
+const uint16_t MAX_DEPTH = 32;
 
-typedef uint16_t NodeIndex;
+//  Node flags. A dirty node had its value or children changed since the
+//  last VisitDirty, and its ancestors are marked as having dirty nodes below.
+const uint8_t NODE_DIRTY = 1;
+const uint8_t NODE_DIRTY_CHILD = 2;
 
 struct OctreeNode {
-    NodeIndex value;
+    NodeValue value;
+    uint8_t flags;
     NodeIndex parent;
+    NodeIndex data;
     NodeIndex children[8];
 };
 
+//  Hermite data of a leaf the surface passes through. Corners are numbered
+//  like children and hold signed distances, negative inside. Every edge that
+//  changes sign keeps where the surface crosses it, as a fraction of the way
+//  from its first corner to its second, and the surface normal there.
+struct HermiteData {
+    float distance[8];
+    float crossing[12];
+    vec3 normals[12];
+    uint32_t vertex;
+};
+
+//  Freed nodes form a list through their parent field and freed Hermite
+//  slots one through their vertex field, both ending in 0: node 0 is the
+//  root and slot 0 stands for "no data", so neither is ever freed.
+//
+//  `generation` changes with every edit, so anything built from the tree
+//  can keep the generation it was built at and skip rebuilding while it
+//  still matches. It is never 0, which can stand for "nothing built".
 struct Octree {
     vec3 center;
     float size;
-    OctreeNode *nodes;
+    Pool<OctreeNode> nodes;
     NodeIndex used;
-    std::queue<NodeIndex> empty_nodes;
-    NodeIndex capacity;
+    NodeIndex free_nodes;
+    NodeIndex free_count;
+    Pool<HermiteData> hermite;
+    NodeIndex hermite_used;
+    NodeIndex free_hermite;
+    uint32_t generation;
 };
 
+void NextGeneration(Octree *octree)
+{
+    if (!++octree->generation) {
+        octree->generation = 1;
+    }
+}
+
 void Init(Octree *octree)
 {
-    octree->nodes = new OctreeNode[BLOCK_SIZE];
-    octree->capacity = BLOCK_SIZE;
-    octree->nodes[0] = {};
+    PoolInit(&octree->nodes);
+    PoolReserve(&octree->nodes, BLOCK_SIZE);
+    octree->used = 0;
+    octree->free_nodes = 0;
+    octree->free_count = 0;
+    *PoolGet(&octree->nodes, 0) = {};
+    PoolInit(&octree->hermite);
+    octree->hermite_used = 0;
+    octree->free_hermite = 0;
+    octree->generation = 1;
     memcpy(octree->center, vec3{0, 0, 0}, sizeof(vec3));
     octree->size = 4;
 }
 
 OctreeNode * GetNode(Octree *octree, NodeIndex node)
 {
-    return &octree->nodes[node];
+    return PoolGet(&octree->nodes, node);
 }
 
 void ClearNode(Octree *octree, NodeIndex node)
@@ -63,40 +112,218 @@ void ClearNode(Octree *octree, NodeIndex node)
     *GetNode(octree, node) = {};
 }
 
+void Clear(Octree *octree)
+{
+    octree->used = 0;
+    octree->free_nodes = 0;
+    octree->free_count = 0;
+    octree->hermite_used = 0;
+    octree->free_hermite = 0;
+    ClearNode(octree, 0);
+    GetNode(octree, 0)->flags = NODE_DIRTY;
+    NextGeneration(octree);
+}
+
+//  Hermite data slot for a leaf. Slot 0 stands for "no data".
+NodeIndex AllocHermite(Octree *octree)
+{
+    if (octree->free_hermite) {
+        NodeIndex data = octree->free_hermite;
+        octree->free_hermite = PoolGet(&octree->hermite, data)->vertex;
+        return data;
+    }
+
+    assert((NodeIndex)(octree->hermite_used + 1) > octree->hermite_used);
+    PoolReserve(&octree->hermite, (size_t)octree->hermite_used + 2);
+
+    return ++octree->hermite_used;
+}
+
+void FreeHermite(Octree *octree, NodeIndex data)
+{
+    assert(data && (uint32_t)octree->free_hermite == octree->free_hermite);
+
+    PoolGet(&octree->hermite, data)->vertex = (uint32_t)octree->free_hermite;
+    octree->free_hermite = data;
+}
+
+HermiteData * GetHermite(Octree *octree, NodeIndex node)
+{
+    NodeIndex data = GetNode(octree, node)->data;
+    return data ? PoolGet(&octree->hermite, data) : nullptr;
+}
+
+//  Takes a node off the free list, or a new one from the end of the pool.
+//  Its contents are left as they were.
+NodeIndex AllocNode(Octree *octree)
+{
+    if (octree->free_nodes) {
+        NodeIndex index = octree->free_nodes;
+        octree->free_nodes = GetNode(octree, index)->parent;
+        octree->free_count--;
+        return index;
+    }
+
+    assert((NodeIndex)(octree->used + 1) > octree->used);
+    PoolReserve(&octree->nodes, (size_t)octree->used + 2);
+
+    return ++octree->used;
+}
+
 void SplitNode(Octree *octree, NodeIndex node)
 {
+    OctreeNode *parent = GetNode(octree, node);
+
     for (size_t i = 0; i < 8; ++i) {
-        NodeIndex index;
+        NodeIndex index = AllocNode(octree);
 
-        if (octree->used + 1 >= octree->capacity) {
-            //TODO: add more space
+        OctreeNode *child = GetNode(octree, index);
+        *child = {};
+        child->parent = node;
+        parent->children[i] = index;
+    }
+}
+
+inline bool HasChildren(const OctreeNode *n)
+{
+    return n->children[0] 
+        || n->children[1] 
+        || n->children[2] 
+        || n->children[3]
+        || n->children[4] 
+        || n->children[5] 
+        || n->children[6]
+        || n->children[7];
+}
+
+bool HasChildren(Octree *octree, NodeIndex node)
+{
+    return HasChildren(GetNode(octree, node));
+}
+
+//  Flags a node and walks up through its parents, stopping at the first one
+//  that already knows about dirty nodes below. Every edit ends up here, so
+//  this is also where the generation moves on.
+void MarkDirty(Octree *octree, NodeIndex node)
+{
+    NextGeneration(octree);
+
+    OctreeNode *n = GetNode(octree, node);
+    n->flags |= NODE_DIRTY;
+
+    while (node) {
+        node = n->parent;
+        n = GetNode(octree, node);
+
+        if (n->flags & NODE_DIRTY_CHILD) {
+            break;
         }
 
-        if (octree->empty_nodes.size()) {
-            index = octree->empty_nodes.front();
-            octree->empty_nodes.pop();
-        } else {
-            index = ++octree->used;
+        n->flags |= NODE_DIRTY_CHILD;
+    }
+}
+
+//  Splits a leaf, handing its value down to the new children. Hermite data
+//  describes the leaf as a whole, so it is dropped.
+void SplitLeaf(Octree *octree, NodeIndex node)
+{
+    SplitNode(octree, node);
+
+    OctreeNode *n = GetNode(octree, node);
+
+    if (n->value) {
+        for (size_t i = 0; i < 8; ++i) {
+            GetNode(octree, n->children[i])->value = n->value;
         }
+    }
+
+    if (n->data) {
+        FreeHermite(octree, n->data);
+        n->data = 0;
+    }
 
-        GetNode(octree, node)->children[i] = index;
-        ClearNode(octree, index);
-        GetNode(octree, index)->parent = node;
-    }   
+    n->value = 0;
+    MarkDirty(octree, node);
 }
 
-bool HasChildren(Octree *octree, NodeIndex node)
+//  Puts every node below `node` on the free list, making it a leaf.
+static void FreeChildren(Octree *octree, NodeIndex node)
 {
-    return octree->nodes[node].children[0] 
-        || octree->nodes[node].children[1] 
-        || octree->nodes[node].children[2] 
-        || octree->nodes[node].children[3]
-        || octree->nodes[node].children[4] 
-        || octree->nodes[node].children[5] 
-        || octree->nodes[node].children[6]
-        || octree->nodes[node].children[7];
+    OctreeNode *n = GetNode(octree, node);
+
+    for (size_t i = 0; i < 8; ++i) {
+        NodeIndex index = n->children[i];
+        OctreeNode *child = GetNode(octree, index);
+
+        if (HasChildren(child)) {
+            FreeChildren(octree, index);
+        }
+
+        if (child->data) {
+            FreeHermite(octree, child->data);
+        }
+
+        *child = {};
+        child->parent = octree->free_nodes;
+        octree->free_nodes = index;
+        octree->free_count++;
+
+        n->children[i] = 0;
+    }
+}
+
+//  Merges the children of a node into it when they are leaves without
+//  Hermite data that all hold the same value, empty or not.
+bool CollapseNode(Octree *octree, NodeIndex node)
+{
+    OctreeNode *n = GetNode(octree, node);
+
+    if (!HasChildren(n)) {
+        return false;
+    }
+
+    NodeValue value = GetNode(octree, n->children[0])->value;
+
+    for (size_t i = 0; i < 8; ++i) {
+        OctreeNode *child = GetNode(octree, n->children[i]);
+
+        if (HasChildren(child) || child->data || child->value != value) {
+            return false;
+        }
+    }
+
+    FreeChildren(octree, node);
+
+    // Nothing is left below to be dirty.
+    n->value = value;
+    n->flags = 0;
+    MarkDirty(octree, node);
+
+    return true;
+}
+
+static void CollapseTree(Octree *octree, NodeIndex node)
+{
+    OctreeNode *n = GetNode(octree, node);
+
+    if (HasChildren(n)) {
+        for (size_t i = 0; i < 8; ++i) {
+            CollapseTree(octree, n->children[i]);
+        }
+
+        CollapseNode(octree, node);
+    }
+}
+
+//  Merges every uniform subtree into a single leaf, bottom-up.
+void Collapse(Octree *octree)
+{
+    CollapseTree(octree, 0);
 }
 
+//  Lines splitting a node into its children, in node sizes from its center:
+//  the three axes through the center, then two lines across each face, for
+//  the faces at +y, -y, +x, -x, +z and -z in that order.
 const vec3 DEBUG_DIVISION[] = {
     {0.5, 0, 0}, {-0.5, 0, 0}, 
     {0, 0.5, 0}, {0, -0.5, 0},
@@ -129,55 +356,341 @@ const vec3 CHILDREN_CENTER_OFFSET[] = {
     {0.5, -0.5, 0.5}
 };
 
+//  Child of a node at `center` that contains p. Points on a split plane go
+//  to the lowest matching index, as the CHILDREN_CENTER_OFFSET scan did.
+inline uint32_t ChildIndex(const vec3 center, const vec3 p)
+{
+    return (p[0] > center[0]) | (p[1] < center[1]) << 1 | (p[2] > center[2]) << 2;
+}
+
+//  Position of a node among the children of its parent, which is its digit
+//  in the locational code of the node. Children taken from the end of the
+//  pool are consecutive, so the offset from the first one usually is it.
+inline uint32_t ChildSlot(Octree *octree, NodeIndex node)
+{
+    const OctreeNode *parent = GetNode(octree, GetNode(octree, node)->parent);
+    uint32_t i = (uint32_t)(node - parent->children[0]);
+
+    if (i < 8 && parent->children[i] == node) {
+        return i;
+    }
+
+    i = 0;
+
+    while (parent->children[i] != node) {
+        ++i;
+    }
+
+    return i;
+}
+
+//  Neighbour in bit space steps (one of -1, 0, 1 per axis), found from the
+//  locational code of the node: digits are rewritten from the bottom up,
+//  with a carry into the parent wherever the step leaves the parent, and
+//  the path is then followed back down from the first common ancestor.
+static NodeIndex FindNeighbourBits(Octree *octree, NodeIndex node, const int step[3])
+{
+    if (!node) {
+        return 0;
+    }
+
+    uint32_t i = ChildSlot(octree, node);
+    uint32_t j = i;
+    int carry[3] = {0, 0, 0};
+    bool up = false;
+
+    for (uint32_t k = 0; k < 3; ++k) {
+        uint32_t bit = (i >> k) & 1;
+
+        if (step[k] && bit == (step[k] > 0)) {
+            carry[k] = step[k];
+            up = true;
+        }
+
+        if (step[k]) {
+            j ^= 1 << k;
+        }
+    }
+
+    NodeIndex q = GetNode(octree, node)->parent;
+
+    // The root has no neighbours, so 0 from the carry means outside.
+    if (up && !(q = FindNeighbourBits(octree, q, carry))) {
+        return 0;
+    }
+
+    OctreeNode *n = GetNode(octree, q);
+    return HasChildren(n) ? n->children[j] : q;
+}
+
+//  Face, edge or vertex neighbour of a node, one step of -1, 0 or 1 along
+//  each world axis. Returns the node of the same size next to it, or the
+//  leaf covering that space when the tree is coarser there, and 0 past the
+//  edge of the tree. Only parent links are walked, so on average this
+//  costs a few steps up and down instead of a descent from the root.
+NodeIndex FindNeighbour(Octree *octree, NodeIndex node, int dx, int dy, int dz)
+{
+    const int step[3] = {dx, -dy, dz};
+    return FindNeighbourBits(octree, node, step);
+}
+
 void InsertPoint(Octree *octree, NodeIndex node, vec3 center, vec3 p, uint16_t depth, uint16_t max_depth)
 {
-    if (depth >= max_depth) {
-        octree->nodes[node].value = 0xffff;
+    vec3 c;
+    memcpy(c, center, sizeof(vec3));
+    float scale = octree->size / (size_t(2) << depth);
+
+    for (; depth < max_depth; ++depth) {
+        OctreeNode *n = GetNode(octree, node);
+
+        if (!HasChildren(n)) {
+            if (n->value == 0xffff) {
+                return;
+            }
+
+            SplitLeaf(octree, node);
+        }
+
+        uint32_t i = ChildIndex(c, p);
+
+        vec3 offset;
+        vec3_scale(offset, CHILDREN_CENTER_OFFSET[i], scale);
+        vec3_add(c, c, offset);
+        scale *= 0.5f;
+
+        node = GetNode(octree, node)->children[i];
+    }
+
+    if (GetNode(octree, node)->value != 0xffff) {
+        GetNode(octree, node)->value = 0xffff;
+        MarkDirty(octree, node);
+    }
+}
+
+//  Inserts a batch of points from the root. The path of the previous point
+//  is kept, and a point only descends from the first level where it takes a
+//  different child, so coherent batches skip most of the tree walk.
+void InsertPoints(Octree *octree, const vec3 *points, size_t count, uint16_t max_depth)
+{
+    assert(max_depth <= MAX_DEPTH);
+
+    NodeIndex path[MAX_DEPTH + 1];
+    vec3 centers[MAX_DEPTH + 1];
+    float scales[MAX_DEPTH];
+    uint8_t children[MAX_DEPTH];
+    uint16_t valid = 0;
+
+    path[0] = 0;
+    memcpy(centers[0], octree->center, sizeof(vec3));
+    scales[0] = octree->size / 2;
+    for (uint16_t l = 1; l < max_depth; ++l) {
+        scales[l] = scales[l - 1] * 0.5f;
+    }
+
+    for (size_t k = 0; k < count; ++k) {
+        const float *p = points[k];
+        uint16_t l = 0;
+
+        while (l < valid && ChildIndex(centers[l], p) == children[l]) {
+            ++l;
+        }
+
+        for (; l < max_depth; ++l) {
+            OctreeNode *n = GetNode(octree, path[l]);
+
+            if (!HasChildren(n)) {
+                if (n->value == 0xffff) {
+                    break;
+                }
+
+                SplitLeaf(octree, path[l]);
+            }
+
+            uint32_t i = ChildIndex(centers[l], p);
+            children[l] = i;
+
+            vec3 offset;
+            vec3_scale(offset, CHILDREN_CENTER_OFFSET[i], scales[l]);
+            vec3_add(centers[l + 1], centers[l], offset);
+
+            path[l + 1] = GetNode(octree, path[l])->children[i];
+        }
+
+        valid = l;
+
+        // Stopped early inside a full leaf, nothing to change.
+        if (l < max_depth) {
+            continue;
+        }
+
+        OctreeNode *leaf = GetNode(octree, path[max_depth]);
+        if (leaf->value != 0xffff) {
+            leaf->value = 0xffff;
+            MarkDirty(octree, path[max_depth]);
+        }
+    }
+}
+
+//  Empties the max_depth cell holding p, freeing anything below it. A
+//  coarser full leaf on the way is split down to that cell first, and the
+//  path then collapses back up for as long as the siblings are uniform, so
+//  removing the last point of a region gives its nodes back.
+void RemovePoint(Octree *octree, const vec3 p, uint16_t max_depth)
+{
+    assert(max_depth <= MAX_DEPTH);
+
+    NodeIndex path[MAX_DEPTH];
+    NodeIndex node = 0;
+    uint16_t depth = 0;
+    vec3 c;
+    memcpy(c, octree->center, sizeof(vec3));
+    float scale = octree->size / 4;
+
+    for (; depth < max_depth; ++depth) {
+        OctreeNode *n = GetNode(octree, node);
+
+        if (!HasChildren(n)) {
+            if (!n->value) {
+                return;
+            }
+
+            SplitLeaf(octree, node);
+        }
+
+        uint32_t i = ChildIndex(c, p);
+
+        vec3 offset;
+        vec3_scale(offset, CHILDREN_CENTER_OFFSET[i], 2 * scale);
+        vec3_add(c, c, offset);
+        scale *= 0.5f;
+
+        path[depth] = node;
+        node = GetNode(octree, node)->children[i];
+    }
+
+    OctreeNode *leaf = GetNode(octree, node);
+
+    if (HasChildren(leaf)) {
+        FreeChildren(octree, node);
+        leaf->flags = 0;
+    } else if (!leaf->value) {
+        return;
+    }
+
+    if (leaf->data) {
+        FreeHermite(octree, leaf->data);
+        leaf->data = 0;
+    }
+
+    leaf->value = 0;
+    MarkDirty(octree, node);
+
+    while (depth > 0 && CollapseNode(octree, path[--depth])) {
+    }
+}
+
+typedef void (*DirtyFn)(Octree *octree, NodeIndex node, const vec3 center, uint16_t depth, void *user);
+typedef void (*LeafFn)(const vec3 center, float size, NodeValue value, void *user);
+
+static void ClearDirty(Octree *octree, NodeIndex node)
+{
+    OctreeNode *n = GetNode(octree, node);
+    bool below = n->flags & NODE_DIRTY_CHILD;
+    n->flags = 0;
+
+    if (below) {
+        for (size_t i = 0; i < 8; ++i) {
+            ClearDirty(octree, n->children[i]);
+        }
+    }
+}
+
+static void VisitDirtyNode(Octree *octree, NodeIndex node, const vec3 center, uint16_t depth, DirtyFn fn, void *user)
+{
+    OctreeNode *n = GetNode(octree, node);
+
+    if (n->flags & NODE_DIRTY) {
+        fn(octree, node, center, depth, user);
+        ClearDirty(octree, node);
         return;
     }
 
-    if (!HasChildren(octree, node)) {
-        SplitNode(octree, node);
+    if (!(n->flags & NODE_DIRTY_CHILD)) {
+        return;
     }
 
-    vec3 pn;
-    vec3_sub(pn, p, center);
+    n->flags = 0;
 
     for (size_t i = 0; i < 8; ++i) {
-        if (pn[0] * CHILDREN_CENTER_OFFSET[i][0] * 2 >= 0 && 
-            pn[1] * CHILDREN_CENTER_OFFSET[i][1] * 2 >= 0 && 
-            pn[2] * CHILDREN_CENTER_OFFSET[i][2] * 2 >= 0) 
-        {
-            vec3 child_center;
-            float scale = 2<<(depth);
-            if (!scale) scale = 1.0f;
-            vec3_scale(child_center, CHILDREN_CENTER_OFFSET[i], 1.0f * octree->size / scale);
-            vec3_add(child_center, center, child_center);
-            InsertPoint(octree, octree->nodes[node].children[i], child_center, p, depth + 1, max_depth);
+        vec3 c;
+        vec3_scale(c, CHILDREN_CENTER_OFFSET[i], octree->size / (size_t(2) << depth));
+        vec3_add(c, center, c);
 
-            return;
+        VisitDirtyNode(octree, n->children[i], c, depth + 1, fn, user);
+    }
+}
+
+//  Calls fn on the topmost nodes that changed since the last call, so each
+//  changed subtree is reported once, and clears the flags on the way. Only
+//  the paths down to dirty nodes are walked. fn must not edit the tree.
+void VisitDirty(Octree *octree, DirtyFn fn, void *user)
+{
+    VisitDirtyNode(octree, 0, octree->center, 0, fn, user);
+}
+
+const size_t DEBUG_DIVISION_VERTS = sizeof(DEBUG_DIVISION) / sizeof(vec3);
+const uint32_t DEBUG_ALL_FACES = 0x3f;
+
+//  Writes the lines of a node, leaving out the faces not set in `faces`.
+//  Writes nothing and returns false when they don't fit in len vertices.
+bool DebugDivision(vec3 start, float size, vec3 *vert, size_t len, size_t *index, uint32_t faces = DEBUG_ALL_FACES)
+{
+    if (*index + DEBUG_DIVISION_VERTS > len) {
+        return false;
+    }
+
+    for (size_t i = 0; i < DEBUG_DIVISION_VERTS; ++i) {
+        if (i >= 6 && !(faces & (1 << ((i - 6) / 4)))) {
+            continue;
         }
+
+        vec3 offset;
+
+        vec3_scale(offset, DEBUG_DIVISION[i], size);
+        vec3_add(offset, start, offset);
+
+        memcpy(vert[(*index)++], offset, sizeof(vec3));
     }
 
-    fmt::print("what\n");
+    return true;
 }
 
+//  Steps to the neighbours across the +y, +x and +z faces, the faces at
+//  bits 0, 2 and 4 of a DebugDivision face mask.
+const int DEBUG_FACE_STEPS[3][3] = {{0, 1, 0}, {1, 0, 0}, {0, 0, 1}};
+
+//  Lines of every node down to max_depth, until len vertices are used up.
+//  A face shared with a split neighbour of the same size is left to the
+//  neighbour on the high side, as in the culled DebugLineList below.
 void DebugLineList(Octree *octree, NodeIndex node, vec3 start, vec3 *vert, size_t len, size_t depth, size_t max_depth, size_t *index) 
 {
     if (!HasChildren(octree, node) || depth == max_depth) {
         return;
     }
 
-    for (size_t i = 0; i < sizeof(DEBUG_DIVISION) / sizeof(vec3); ++i) {
-        vec3 offset;
-        
-        float scale = 2<<(depth - 1);
-        if (!scale) scale = 1.0f;
+    uint32_t faces = DEBUG_ALL_FACES;
 
-        vec3_scale(offset, DEBUG_DIVISION[i], 1 * octree->size / scale);
-        vec3_add(offset, start, offset);
-        
-        memcpy(vert[(*index)++], offset, sizeof(vec3));
+    for (uint32_t f = 0; f < 3; ++f) {
+        const int *step = DEBUG_FACE_STEPS[f];
+        NodeIndex neighbour = FindNeighbour(octree, node, step[0], step[1], step[2]);
+
+        if (neighbour && HasChildren(octree, neighbour)) {
+            faces &= ~(1 << (2 * f));
+        }
+    }
+
+    if (!DebugDivision(start, octree->size / (size_t(1) << depth), vert, len, index, faces)) {
+        return;
     }
 
     for (size_t i = 0; i < 8; ++i) {
@@ -185,49 +698,149 @@ void DebugLineList(Octree *octree, NodeIndex node, vec3 start, vec3 *vert, size_
         vec3_scale(child_start, CHILDREN_CENTER_OFFSET[i], 1.0f * octree->size / (2<<depth));
         vec3_add(child_start, start, child_start);
 
-        DebugLineList(octree, octree->nodes[node].children[i], child_start, vert, len, depth + 1, max_depth, index);
+        DebugLineList(octree, GetNode(octree, node)->children[i], child_start, vert, len, depth + 1, max_depth, index);
     }
 
     return;
 }
 
-static void volume_proc(Octree *octree, NodeIndex q1);
-static void face_proc(Octree *octree, NodeIndex q1, NodeIndex q2);
-static void edge_proc(Octree *octree, NodeIndex q1, NodeIndex q2, NodeIndex q3, NodeIndex q4);
+//  What DebugLineList can see: the frustum planes of a view-projection
+//  matrix, pointing inwards, and how many pixels a unit of size covers at
+//  w = 1, below which nodes stop being split into lines.
+struct DebugView {
+    vec4 planes[6];
+    mat4x4 view_proj;
+    float pixel_scale;
+    float min_pixels;
+};
 
-static void volume_proc(Octree *octree, NodeIndex q1)
+//  Frustum planes come from the rows of the matrix (Gribb and Hartmann),
+//  for the [-1, 1] clip space linmath projections use.
+void DebugViewInit(DebugView *view, mat4x4 view_proj, float pixel_scale, float min_pixels)
 {
-    uint16_t *child = GetNode(octree, q1)->children;
+    mat4x4_dup(view->view_proj, view_proj);
+    view->pixel_scale = pixel_scale;
+    view->min_pixels = min_pixels;
 
-    for (size_t i = 0; i < 8; ++i) {
-        face_proc(octree, child[i]);
-    }
+    for (int i = 0; i < 6; ++i) {
+        int row = i / 2;
+        float sign = i & 1 ? -1.0f : 1.0f;
 
-    edge_proc(octree, child[0], child[1], child[2], child[3]);
-    edge_proc(octree, child[4], child[5], child[6], child[7]);
-    edge_proc(octree, child[1], child[5], child[7], child[3]);
-    edge_proc(octree, child[0], child[4], child[6], child[2]);
-    edge_proc(octree, child[2], child[3], child[7], child[6]);
-    edge_proc(octree, child[0], child[4], child[5], child[1]);
+        for (int k = 0; k < 4; ++k) {
+            view->planes[i][k] = view_proj[k][3] + sign * view_proj[k][row];
+        }
+    }
+}
 
-    vert_proc(octree, 
-        child[0], child[1], 
-        child[2], child[3], 
-        child[4], child[5], 
-        child[6], child[7]
-    );
+//  Whether a node is big enough on screen to be split into lines, from the
+//  clip w of its center. Nodes reaching behind the eye always are.
+inline bool DebugSplitVisible(const DebugView *view, const vec3 center, float size)
+{
+    float w = view->view_proj[0][3] * center[0] + view->view_proj[1][3] * center[1] + view->view_proj[2][3] * center[2] + view->view_proj[3][3];
+    return w <= size || size * view->pixel_scale >= view->min_pixels * w;
 }
 
-static void edge_proc(Octree *octree, NodeIndex q1, NodeIndex q2, NodeIndex q3, NodeIndex q4)
+//  Level of detail and frustum culled DebugLineList. Subtrees outside the
+//  view are skipped and a node is not split into lines once it covers fewer
+//  than min_pixels, so the work follows what is on screen. `planes` holds
+//  the frustum planes the parent was not yet fully inside of.
+//
+//  Two split nodes of the same size sharing a face would both draw the
+//  lines across it, so the one on the high side does and the other leaves
+//  the face out. Stops once len vertices are used up.
+//
+//  The wireframe in main.cpp keeps its chunks from frame to frame however
+//  the camera moves, so it only takes the frustum planes of a DebugView
+//  and culls whole chunks. This walk is kept for one-off views of a whole
+//  tree, such as bench_debug_view measures.
+void DebugLineList(Octree *octree, NodeIndex node, vec3 start, vec3 *vert, size_t len, size_t depth, size_t max_depth, size_t *index, const DebugView *view, uint32_t planes = 0x3f)
 {
-    
+    if (!HasChildren(octree, node) || depth == max_depth) {
+        return;
+    }
+
+    float size = octree->size / (size_t(1) << depth);
+    float half = size / 2;
+
+    for (uint32_t i = 0; i < 6; ++i) {
+        if (!(planes & (1 << i))) {
+            continue;
+        }
+
+        const float *plane = view->planes[i];
+        float distance = vec3_mul_dot(plane, start) + plane[3];
+        float radius = half * (fabsf(plane[0]) + fabsf(plane[1]) + fabsf(plane[2]));
+
+        if (distance < -radius) {
+            return;
+        }
+
+        if (distance > radius) {
+            planes &= ~(1 << i);
+        }
+    }
+
+    if (!DebugSplitVisible(view, start, size)) {
+        return;
+    }
+
+    uint32_t faces = DEBUG_ALL_FACES;
+
+    for (uint32_t f = 0; f < 3; ++f) {
+        const int *step = DEBUG_FACE_STEPS[f];
+        NodeIndex neighbour = FindNeighbour(octree, node, step[0], step[1], step[2]);
+
+        if (neighbour && HasChildren(octree, neighbour)) {
+            vec3 center = {start[0] + step[0] * size, start[1] + step[1] * size, start[2] + step[2] * size};
+
+            if (DebugSplitVisible(view, center, size)) {
+                faces &= ~(1 << (2 * f));
+            }
+        }
+    }
+
+    if (!DebugDivision(start, size, vert, len, index, faces)) {
+        return;
+    }
+
+    for (size_t i = 0; i < 8; ++i) {
+        vec3 child_start;
+        vec3_scale(child_start, CHILDREN_CENTER_OFFSET[i], 1.0f * octree->size / (2<<depth));
+        vec3_add(child_start, start, child_start);
+
+        DebugLineList(octree, GetNode(octree, node)->children[i], child_start, vert, len, depth + 1, max_depth, index, view, planes);
+    }
 }
 
 void Cleanup(Octree *octree)
 {
-    delete[] octree->nodes;
+    PoolCleanup(&octree->nodes);
+    PoolCleanup(&octree->hermite);
+}
+
+//  Everything but the pools, for a copy whose pools are already copied.
+void CopyFields(Octree *dst, Octree *src)
+{
+    memcpy(dst->center, src->center, sizeof(vec3));
+    dst->size = src->size;
+    dst->used = src->used;
+    dst->free_nodes = src->free_nodes;
+    dst->free_count = src->free_count;
+    dst->hermite_used = src->hermite_used;
+    dst->free_hermite = src->free_hermite;
+    dst->generation = src->generation;
+}
+
+//  Makes `dst`, an initialised tree, a copy of `src` with the same node
+//  indices, generation and free lists. Only the used part of the pools is
+//  copied.
+void Copy(Octree *dst, Octree *src)
+{
+    PoolCopy(&dst->nodes, &src->nodes, 0, (size_t)src->used + 1);
+    PoolCopy(&dst->hermite, &src->hermite, 0, src->hermite_used ? (size_t)src->hermite_used + 1 : 0);
+    CopyFields(dst, src);
 }
 
 }
 
-#endif
\ No newline at end of file
+#endif
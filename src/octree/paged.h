@@ -0,0 +1,540 @@
+#ifndef OCTREE_PAGED_H
+#define OCTREE_PAGED_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "octree.h"
+#include "build.h"
+#include "raycast.h"
+
+namespace Octree {
+
+//  Out-of-core octree. The levels above page_depth are implicit: every cell
+//  at page_depth has a slot in `roots` holding the page its subtree starts
+//  in, or 0 when it is empty. Pages are fixed-size blocks of nodes kept in a
+//  backing file and brought in on demand by an LRU cache that never holds
+//  more than its budget. Children come in blocks of eight inside a page.
+//  When a page runs out of room, the node being split moves to the page's
+//  overflow page and is left behind as a PAGE_LINK, holding the page it
+//  went to in `child` and its index there in `value`.
+//
+//  Any node pointer is only good until the next page is acquired, so the
+//  walks below keep (page, node) pairs and look nodes up again as needed.
+
+const uint32_t PAGE_NODES = 4096;
+const uint16_t PAGE_LINK = 1;
+const uint32_t NO_SLOT = 0xffffffffu;
+
+struct PageNode {
+    uint32_t child;
+    NodeValue value;
+    uint16_t flags;
+};
+
+struct Page {
+    uint32_t used;
+    uint32_t overflow;
+    PageNode nodes[PAGE_NODES - 1];
+};
+
+struct PageSlot {
+    uint32_t page;
+    uint32_t prev;
+    uint32_t next;
+    bool dirty;
+};
+
+struct PagedStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t writes;
+};
+
+struct PagedOctree {
+    vec3 center;
+    float size;
+    uint16_t page_depth;
+    uint32_t *roots;
+
+    FILE *file;
+    uint32_t page_count;
+    uint32_t *resident;
+
+    Page *pages;
+    PageSlot *slots;
+    uint32_t slot_count;
+    uint32_t slots_used;
+    uint32_t head;
+    uint32_t tail;
+
+    PagedStats stats;
+};
+
+static bool PageSeek(FILE *file, uint32_t page)
+{
+    int64_t offset = (int64_t)(page - 1) * sizeof(Page);
+#ifdef _WIN32
+    return _fseeki64(file, offset, SEEK_SET) == 0;
+#else
+    return fseeko(file, offset, SEEK_SET) == 0;
+#endif
+}
+
+//  Opens a paged octree backed by a scratch file at `path`. The cache holds
+//  as many pages as fit in budget_bytes, but never fewer than two.
+bool Init(PagedOctree *paged, const char *path, uint16_t page_depth, size_t budget_bytes)
+{
+    assert(page_depth <= 7);
+
+    *paged = {};
+    paged->file = fopen(path, "w+b");
+    if (!paged->file) {
+        return false;
+    }
+
+    memcpy(paged->center, vec3{0, 0, 0}, sizeof(vec3));
+    paged->size = 4;
+    paged->page_depth = page_depth;
+    paged->roots = (uint32_t *)calloc(size_t(1) << (3 * page_depth), sizeof(uint32_t));
+
+    size_t slots = budget_bytes / sizeof(Page);
+    paged->slot_count = (uint32_t)(slots < 2 ? 2 : slots);
+    paged->pages = (Page *)malloc(paged->slot_count * sizeof(Page));
+    paged->slots = (PageSlot *)malloc(paged->slot_count * sizeof(PageSlot));
+    paged->head = paged->tail = NO_SLOT;
+
+    return true;
+}
+
+static void PageUnlink(PagedOctree *paged, uint32_t slot)
+{
+    PageSlot *s = &paged->slots[slot];
+
+    if (s->prev != NO_SLOT) {
+        paged->slots[s->prev].next = s->next;
+    } else {
+        paged->head = s->next;
+    }
+
+    if (s->next != NO_SLOT) {
+        paged->slots[s->next].prev = s->prev;
+    } else {
+        paged->tail = s->prev;
+    }
+}
+
+static void PagePushFront(PagedOctree *paged, uint32_t slot)
+{
+    PageSlot *s = &paged->slots[slot];
+    s->prev = NO_SLOT;
+    s->next = paged->head;
+
+    if (paged->head != NO_SLOT) {
+        paged->slots[paged->head].prev = slot;
+    } else {
+        paged->tail = slot;
+    }
+
+    paged->head = slot;
+}
+
+static void PageWrite(PagedOctree *paged, uint32_t slot)
+{
+    PageSlot *s = &paged->slots[slot];
+
+    if (s->dirty) {
+        bool ok = PageSeek(paged->file, s->page) && fwrite(&paged->pages[slot], sizeof(Page), 1, paged->file) == 1;
+        assert(ok);
+        (void)ok;
+
+        s->dirty = false;
+        paged->stats.writes++;
+    }
+}
+
+//  Slot for a page that is not resident yet: a free one, or the least
+//  recently used one written back.
+static uint32_t PageTakeSlot(PagedOctree *paged)
+{
+    if (paged->slots_used < paged->slot_count) {
+        return paged->slots_used++;
+    }
+
+    uint32_t slot = paged->tail;
+    PageWrite(paged, slot);
+    PageUnlink(paged, slot);
+    paged->resident[paged->slots[slot].page] = 0;
+    paged->stats.evictions++;
+
+    return slot;
+}
+
+//  Makes a page resident and most recently used. `write` marks it dirty.
+Page * AcquirePage(PagedOctree *paged, uint32_t page, bool write)
+{
+    uint32_t slot = paged->resident[page];
+
+    if (slot) {
+        slot -= 1;
+        paged->stats.hits++;
+
+        if (paged->head != slot) {
+            PageUnlink(paged, slot);
+            PagePushFront(paged, slot);
+        }
+    } else {
+        paged->stats.misses++;
+        slot = PageTakeSlot(paged);
+
+        bool ok = PageSeek(paged->file, page) && fread(&paged->pages[slot], sizeof(Page), 1, paged->file) == 1;
+        assert(ok);
+        (void)ok;
+
+        paged->slots[slot].page = page;
+        paged->slots[slot].dirty = false;
+        paged->resident[page] = slot + 1;
+        PagePushFront(paged, slot);
+    }
+
+    paged->slots[slot].dirty |= write;
+    return &paged->pages[slot];
+}
+
+//  A new, empty resident page. Its first node must be placed on its own
+//  before any block of children, so that no block starts at index 0.
+static uint32_t NewPage(PagedOctree *paged)
+{
+    uint32_t page = ++paged->page_count;
+    paged->resident = (uint32_t *)realloc(paged->resident, (page + 1) * sizeof(uint32_t));
+    paged->resident[page] = 0;
+
+    uint32_t slot = PageTakeSlot(paged);
+    paged->slots[slot].page = page;
+    paged->slots[slot].dirty = true;
+    paged->resident[page] = slot + 1;
+    PagePushFront(paged, slot);
+
+    Page *p = &paged->pages[slot];
+    p->used = 0;
+    p->overflow = 0;
+
+    return page;
+}
+
+inline PageNode * GetNode(PagedOctree *paged, uint32_t page, uint32_t node, bool write = false)
+{
+    return &AcquirePage(paged, page, write)->nodes[node];
+}
+
+//  Follows page links until (page, node) is a real node.
+static void FollowLinks(PagedOctree *paged, uint32_t *page, uint32_t *node)
+{
+    for (;;) {
+        PageNode *n = GetNode(paged, *page, *node);
+
+        if (!(n->flags & PAGE_LINK)) {
+            return;
+        }
+
+        *page = n->child;
+        *node = n->value;
+    }
+}
+
+//  Root slot of the page_depth cell holding p, with its center.
+static uint32_t PageRootSlot(PagedOctree *paged, const vec3 p, vec3 center)
+{
+    uint32_t slot = 0;
+    float scale = paged->size / 4;
+    memcpy(center, paged->center, sizeof(vec3));
+
+    for (uint16_t depth = 0; depth < paged->page_depth; ++depth) {
+        uint32_t i = ChildIndex(center, p);
+        slot = slot << 3 | i;
+
+        vec3 offset;
+        vec3_scale(offset, CHILDREN_CENTER_OFFSET[i], 2 * scale);
+        vec3_add(center, center, offset);
+        scale *= 0.5f;
+    }
+
+    return slot;
+}
+
+void InsertPoint(PagedOctree *paged, const vec3 p, uint16_t max_depth)
+{
+    assert(max_depth >= paged->page_depth && max_depth <= MAX_DEPTH);
+
+    vec3 c;
+    uint32_t slot = PageRootSlot(paged, p, c);
+
+    if (!paged->roots[slot]) {
+        uint32_t root = NewPage(paged);
+        Page *pg = AcquirePage(paged, root, true);
+        pg->nodes[pg->used++] = {};
+        paged->roots[slot] = root;
+    }
+
+    uint32_t page = paged->roots[slot];
+    uint32_t node = 0;
+    float scale = paged->size / (size_t(2) << paged->page_depth);
+
+    for (uint16_t depth = paged->page_depth; depth < max_depth; ++depth) {
+        FollowLinks(paged, &page, &node);
+
+        Page *pg = AcquirePage(paged, page, true);
+        PageNode *n = &pg->nodes[node];
+
+        if (!n->child) {
+            if (pg->used + 8 > PAGE_NODES - 1) {
+                PageNode moved = *n;
+                uint32_t overflow = pg->overflow;
+
+                if (!overflow || AcquirePage(paged, overflow, false)->used + 9 > PAGE_NODES - 1) {
+                    overflow = NewPage(paged);
+                }
+
+                // Bringing the overflow page in may have evicted this one,
+                // so both are fetched again before writing to them.
+                pg = AcquirePage(paged, page, true);
+                pg->overflow = overflow;
+
+                Page *target = AcquirePage(paged, overflow, true);
+                uint32_t index = target->used++;
+                target->nodes[index] = moved;
+
+                n = &pg->nodes[node];
+                n->flags = PAGE_LINK;
+                n->child = overflow;
+                n->value = (NodeValue)index;
+
+                page = overflow;
+                node = index;
+                pg = target;
+                n = &pg->nodes[node];
+            }
+
+            n->child = pg->used;
+            pg->used += 8;
+            memset(&pg->nodes[n->child], 0, 8 * sizeof(PageNode));
+        }
+
+        uint32_t i = ChildIndex(c, p);
+        node = n->child + i;
+
+        vec3 offset;
+        vec3_scale(offset, CHILDREN_CENTER_OFFSET[i], scale);
+        vec3_add(c, c, offset);
+        scale *= 0.5f;
+    }
+
+    FollowLinks(paged, &page, &node);
+    GetNode(paged, page, node, true)->value = 0xffff;
+}
+
+//  Inserts a batch in Morton order. Points then arrive grouped by root page,
+//  so each page is brought in about once even when the tree is far larger
+//  than the cache, and overflow pages fill with neighbouring subtrees.
+void InsertPoints(PagedOctree *paged, const vec3 *points, size_t count, uint16_t max_depth)
+{
+    uint16_t depth = std::min(max_depth, MORTON_MAX_DEPTH);
+    std::vector<std::pair<uint64_t, size_t>> order(count);
+
+    for (size_t i = 0; i < count; ++i) {
+        order[i] = {MortonEncode(paged->center, paged->size, points[i], depth), i};
+    }
+
+    std::sort(order.begin(), order.end());
+
+    for (size_t i = 0; i < count; ++i) {
+        InsertPoint(paged, points[order[i].second], max_depth);
+    }
+}
+
+static void VisitPagedNode(PagedOctree *paged, uint32_t page, uint32_t node, const vec3 center, float size, LeafFn fn, void *user)
+{
+    FollowLinks(paged, &page, &node);
+    PageNode n = *GetNode(paged, page, node);
+
+    if (!n.child) {
+        if (n.value) {
+            fn(center, size, n.value, user);
+        }
+
+        return;
+    }
+
+    for (uint32_t i = 0; i < 8; ++i) {
+        vec3 c;
+        vec3_scale(c, CHILDREN_CENTER_OFFSET[i], size / 2);
+        vec3_add(c, center, c);
+
+        VisitPagedNode(paged, page, n.child + i, c, size / 2, fn, user);
+    }
+}
+
+static void VisitPagedTop(PagedOctree *paged, uint32_t slot, uint16_t depth, const vec3 center, float size, LeafFn fn, void *user)
+{
+    if (depth == paged->page_depth) {
+        if (paged->roots[slot]) {
+            VisitPagedNode(paged, paged->roots[slot], 0, center, size, fn, user);
+        }
+
+        return;
+    }
+
+    for (uint32_t i = 0; i < 8; ++i) {
+        vec3 c;
+        vec3_scale(c, CHILDREN_CENTER_OFFSET[i], size / 2);
+        vec3_add(c, center, c);
+
+        VisitPagedTop(paged, slot << 3 | i, depth + 1, c, size / 2, fn, user);
+    }
+}
+
+//  Calls fn on every non-empty leaf, one root page at a time.
+void VisitLeaves(PagedOctree *paged, LeafFn fn, void *user)
+{
+    VisitPagedTop(paged, 0, 0, paged->center, paged->size, fn, user);
+}
+
+//  RayCast across pages. Above page_depth the frames hold root slots, below
+//  it local nodes of the page kept alongside them. The node of the hit is
+//  page * PAGE_NODES + local node.
+bool RayCast(PagedOctree *paged, const vec3 origin, const vec3 dir, RayHit *hit)
+{
+    float half = paged->size / 2;
+    vec3 inv, min, max;
+    float tmin, tmax;
+
+    ray_inverse(inv, dir);
+    for (size_t k = 0; k < 3; ++k) {
+        min[k] = paged->center[k] - half;
+        max[k] = paged->center[k] + half;
+    }
+
+    if (!intersect_aabb(origin, inv, min, max, &tmin, &tmax) || tmax < 0) {
+        return false;
+    }
+
+    RayFrame stack[MAX_DEPTH + 1];
+    uint32_t pages[MAX_DEPTH + 1];
+    uint16_t depth = 0;
+
+    stack[0].node = 0;
+    stack[0].child = RAY_ENTER;
+    pages[0] = paged->page_depth ? 0 : paged->roots[0];
+
+    if (!paged->page_depth && !pages[0]) {
+        return false;
+    }
+
+    uint32_t mask = RaySetup(paged->center, half, origin, dir, stack[0].t0, stack[0].t1);
+
+    for (;;) {
+        RayFrame *top = &stack[depth];
+
+        if (top->child == RAY_ENTER) {
+            top->child = RAY_DONE;
+
+            if (top->t1[0] < 0 || top->t1[1] < 0 || top->t1[2] < 0) {
+                // Behind the origin.
+            } else {
+                bool leaf = false;
+
+                if (depth >= paged->page_depth) {
+                    FollowLinks(paged, &pages[depth], &top->node);
+                    PageNode *n = GetNode(paged, pages[depth], top->node);
+
+                    if (!n->child) {
+                        if (n->value) {
+                            RayReportHit(top->t0, dir, pages[depth] * PAGE_NODES + top->node, hit);
+                            return true;
+                        }
+
+                        leaf = true;
+                    }
+                }
+
+                if (!leaf) {
+                    float tm[3];
+                    for (uint32_t k = 0; k < 3; ++k) {
+                        tm[k] = 0.5f * (top->t0[k] + top->t1[k]);
+                    }
+
+                    top->child = RayFirstChild(top->t0, tm);
+                }
+            }
+        }
+
+        if (top->child == RAY_DONE) {
+            if (!depth) {
+                return false;
+            }
+
+            --depth;
+            continue;
+        }
+
+        RayFrame *next = &stack[depth + 1];
+        uint32_t child = top->child;
+
+        RayChildSpan(top, child, next->t0, next->t1);
+        top->child = RayNextChild(child, next->t1);
+        next->child = RAY_ENTER;
+
+        if (depth + 1 < paged->page_depth) {
+            next->node = top->node << 3 | (child ^ mask);
+            pages[depth + 1] = 0;
+        } else if (depth + 1 == paged->page_depth) {
+            uint32_t root = paged->roots[top->node << 3 | (child ^ mask)];
+
+            if (!root) {
+                continue;
+            }
+
+            next->node = 0;
+            pages[depth + 1] = root;
+        } else {
+            next->node = GetNode(paged, pages[depth], top->node)->child + (child ^ mask);
+            pages[depth + 1] = pages[depth];
+        }
+
+        ++depth;
+    }
+}
+
+//  Writes every dirty resident page back to the file.
+void Flush(PagedOctree *paged)
+{
+    for (uint32_t slot = 0; slot < paged->slots_used; ++slot) {
+        PageWrite(paged, slot);
+    }
+
+    fflush(paged->file);
+}
+
+float HitRate(PagedStats *stats)
+{
+    uint64_t total = stats->hits + stats->misses;
+    return total ? (float)stats->hits / total : 1.0f;
+}
+
+void Cleanup(PagedOctree *paged)
+{
+    if (paged->file) {
+        fclose(paged->file);
+    }
+
+    free(paged->roots);
+    free(paged->resident);
+    free(paged->pages);
+    free(paged->slots);
+    *paged = {};
+}
+
+}
+
+#endif
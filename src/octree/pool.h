@@ -0,0 +1,178 @@
+#ifndef OCTREE_POOL_H
+#define OCTREE_POOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace Octree {
+
+//  Chunk k holds BLOCK_SIZE << k elements, so the pool grows geometrically,
+//  never moves what it already handed out and finds the chunk of an index
+//  with a single bit scan.
+//
+//  A mapped pool points into memory it doesn't own (see PoolMap). It
+//  copies itself into chunks of its own before it grows, and cleanup
+//  leaves the mapped memory alone.
+const size_t BLOCK_SIZE = 1024;
+const uint32_t MAX_CHUNKS = 32;
+
+template <typename T>
+struct Pool {
+    T *chunks[MAX_CHUNKS];
+    uint32_t chunk_count;
+    size_t capacity;
+    bool mapped;
+};
+
+inline uint32_t HighestBit(uint64_t x)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index, x);
+    return index;
+#else
+    return 63 - __builtin_clzll(x);
+#endif
+}
+
+template <typename T>
+void PoolInit(Pool<T> *pool)
+{
+    pool->chunk_count = 0;
+    pool->capacity = 0;
+    pool->mapped = false;
+}
+
+//  Copies a mapped pool into chunks it owns. The last mapped chunk is
+//  usually only partly there, so indices past the mapped count must never
+//  resolve into it.
+template <typename T>
+void PoolDetach(Pool<T> *pool)
+{
+    size_t left = pool->capacity;
+
+    for (uint32_t i = 0; i < pool->chunk_count; ++i) {
+        size_t chunk_size = BLOCK_SIZE << i;
+        size_t n = chunk_size < left ? chunk_size : left;
+
+        T *chunk = new T[chunk_size];
+        memcpy(chunk, pool->chunks[i], n * sizeof(T));
+        pool->chunks[i] = chunk;
+        left -= n;
+    }
+
+    pool->capacity = BLOCK_SIZE * ((size_t(1) << pool->chunk_count) - 1);
+    pool->mapped = false;
+}
+
+template <typename T>
+void PoolReserve(Pool<T> *pool, size_t count)
+{
+    if (pool->mapped && pool->capacity < count) {
+        PoolDetach(pool);
+    }
+
+    while (pool->capacity < count) {
+        assert(pool->chunk_count < MAX_CHUNKS);
+
+        size_t chunk_size = BLOCK_SIZE << pool->chunk_count;
+        pool->chunks[pool->chunk_count++] = new T[chunk_size];
+        pool->capacity += chunk_size;
+    }
+}
+
+//  Makes elements [first, first + count) of `dst` those of `src`, reusing
+//  the chunks `dst` already has.
+template <typename T>
+void PoolCopy(Pool<T> *dst, Pool<T> *src, size_t first, size_t count)
+{
+    if (dst->mapped) {
+        PoolDetach(dst);
+    }
+
+    PoolReserve(dst, first + count);
+
+    while (count) {
+        uint32_t chunk = HighestBit(first / BLOCK_SIZE + 1);
+        size_t offset = first - BLOCK_SIZE * ((size_t(1) << chunk) - 1);
+        size_t n = (BLOCK_SIZE << chunk) - offset;
+        n = n < count ? n : count;
+
+        memcpy(dst->chunks[chunk] + offset, src->chunks[chunk] + offset, n * sizeof(T));
+        first += n;
+        count -= n;
+    }
+}
+
+template <typename T>
+T * PoolGet(Pool<T> *pool, size_t index)
+{
+    uint32_t chunk = HighestBit(index / BLOCK_SIZE + 1);
+    return &pool->chunks[chunk][index - BLOCK_SIZE * ((size_t(1) << chunk) - 1)];
+}
+
+template <typename T>
+size_t PoolBytes(Pool<T> *pool)
+{
+    return pool->capacity * sizeof(T);
+}
+
+//  Writes the first `count` elements in index order. Chunks follow each
+//  other without gaps, so the result is a flat array PoolMap can point at.
+template <typename T>
+bool PoolWrite(Pool<T> *pool, size_t count, FILE *file)
+{
+    for (uint32_t i = 0; count; ++i) {
+        size_t n = BLOCK_SIZE << i;
+        n = n < count ? n : count;
+
+        if (fwrite(pool->chunks[i], sizeof(T), n, file) != n) {
+            return false;
+        }
+
+        count -= n;
+    }
+
+    return true;
+}
+
+//  Points the chunks of an empty pool into `count` elements written by
+//  PoolWrite. The memory stays the caller's, and the pool reads it until
+//  it is cleaned up or grows past `count`.
+template <typename T>
+void PoolMap(Pool<T> *pool, T *base, size_t count)
+{
+    size_t offset = 0;
+    pool->chunk_count = 0;
+
+    while (offset < count) {
+        pool->chunks[pool->chunk_count] = base + offset;
+        offset += BLOCK_SIZE << pool->chunk_count++;
+    }
+
+    pool->capacity = count;
+    pool->mapped = true;
+}
+
+template <typename T>
+void PoolCleanup(Pool<T> *pool)
+{
+    for (uint32_t i = 0; i < pool->chunk_count && !pool->mapped; ++i) {
+        delete[] pool->chunks[i];
+    }
+
+    pool->chunk_count = 0;
+    pool->capacity = 0;
+    pool->mapped = false;
+}
+
+}
+
+#endif
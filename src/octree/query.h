@@ -0,0 +1,214 @@
+#ifndef OCTREE_QUERY_H
+#define OCTREE_QUERY_H
+
+#include <math.h>
+
+#include "octree.h"
+
+namespace Octree {
+
+//  Spatial queries over the occupied leaves of an octree. Both prune whole
+//  subtrees by their bounds and keep their state on the stack, so a query
+//  never allocates.
+
+//  Most leaves QueryNearest can return.
+const uint32_t NEAREST_MAX = 32;
+
+struct NearestHit {
+    NodeIndex node;
+    float distance;
+    vec3 center;
+    float size;
+};
+
+//  Pending node of the nearest search, with the squared distance from the
+//  query point to its box.
+struct NearestFrame {
+    NodeIndex node;
+    float distance;
+    vec3 center;
+    uint16_t depth;
+};
+
+//  Squared distance from p to the box at `center` with half size `half`,
+//  0 inside it.
+inline float BoxDistance2(const vec3 center, float half, const vec3 p)
+{
+    float d2 = 0;
+
+    for (size_t k = 0; k < 3; ++k) {
+        float d = fabsf(p[k] - center[k]) - half;
+        if (d > 0) {
+            d2 += d * d;
+        }
+    }
+
+    return d2;
+}
+
+static void QueryBoxNode(Octree *octree, NodeIndex node, const vec3 center, uint16_t depth, const vec3 min, const vec3 max, LeafFn fn, void *user)
+{
+    float half = octree->size / (size_t(2) << depth);
+
+    for (size_t k = 0; k < 3; ++k) {
+        if (center[k] + half < min[k] || center[k] - half > max[k]) {
+            return;
+        }
+    }
+
+    OctreeNode *n = GetNode(octree, node);
+
+    if (!HasChildren(n)) {
+        if (n->value) {
+            fn(center, 2 * half, n->value, user);
+        }
+
+        return;
+    }
+
+    for (uint32_t i = 0; i < 8; ++i) {
+        vec3 c;
+        vec3_scale(c, CHILDREN_CENTER_OFFSET[i], half);
+        vec3_add(c, center, c);
+
+        QueryBoxNode(octree, n->children[i], c, depth + 1, min, max, fn, user);
+    }
+}
+
+//  Calls fn on every occupied leaf overlapping the box [min, max].
+void QueryBox(Octree *octree, const vec3 min, const vec3 max, LeafFn fn, void *user)
+{
+    QueryBoxNode(octree, 0, octree->center, 0, min, max, fn, user);
+}
+
+//  Puts hit at the top of a max-heap on distance of `size` leaves and moves
+//  it down to where it belongs.
+static void NearestSiftDown(NearestHit *best, uint32_t size, const NearestHit *hit)
+{
+    uint32_t i = 0;
+
+    for (;;) {
+        uint32_t child = 2 * i + 1;
+        if (child >= size) {
+            break;
+        }
+
+        if (child + 1 < size && best[child + 1].distance > best[child].distance) {
+            ++child;
+        }
+
+        if (best[child].distance <= hit->distance) {
+            break;
+        }
+
+        best[i] = best[child];
+        i = child;
+    }
+
+    best[i] = *hit;
+}
+
+//  Adds a leaf to the k best found so far, pushing out the farthest once
+//  there are k. A full heap only takes leaves closer than its top.
+static void NearestPush(NearestHit *best, uint32_t *count, uint32_t k, const NearestHit *hit)
+{
+    if (*count == k) {
+        NearestSiftDown(best, k, hit);
+        return;
+    }
+
+    uint32_t i = (*count)++;
+
+    while (i && best[(i - 1) / 2].distance < hit->distance) {
+        best[i] = best[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+
+    best[i] = *hit;
+}
+
+//  Up to k occupied leaves closest to p, nearest first, with their distance
+//  to p (0 for a leaf containing it). Returns how many were found.
+//
+//  Nodes are taken nearest first: the children of a node go on the stack
+//  farthest first, and anything no closer than the k-th best leaf so far is
+//  dropped. Every level leaves at most seven siblings behind, so the stack
+//  has a fixed size.
+uint32_t QueryNearest(Octree *octree, const vec3 p, uint32_t k, NearestHit *hits)
+{
+    assert(k <= NEAREST_MAX);
+
+    NearestHit best[NEAREST_MAX];
+    uint32_t count = 0;
+
+    NearestFrame stack[8 * (MAX_DEPTH + 1)];
+    uint32_t top = 0;
+
+    stack[top].node = 0;
+    stack[top].distance = BoxDistance2(octree->center, octree->size / 2, p);
+    memcpy(stack[top].center, octree->center, sizeof(vec3));
+    stack[top++].depth = 0;
+
+    while (top && k) {
+        NearestFrame frame = stack[--top];
+
+        if (count == k && frame.distance >= best[0].distance) {
+            continue;
+        }
+
+        OctreeNode *n = GetNode(octree, frame.node);
+        float half = octree->size / (size_t(2) << frame.depth);
+
+        if (!HasChildren(n)) {
+            if (n->value) {
+                NearestHit hit = {frame.node, frame.distance, {}, 2 * half};
+                memcpy(hit.center, frame.center, sizeof(vec3));
+                NearestPush(best, &count, k, &hit);
+            }
+
+            continue;
+        }
+
+        NearestFrame children[8];
+        uint32_t order[8];
+
+        for (uint32_t i = 0; i < 8; ++i) {
+            NearestFrame *child = &children[i];
+            child->node = n->children[i];
+            child->depth = frame.depth + 1;
+            vec3_scale(child->center, CHILDREN_CENTER_OFFSET[i], half);
+            vec3_add(child->center, frame.center, child->center);
+            child->distance = BoxDistance2(child->center, half / 2, p);
+
+            // Insertion sort, farthest first.
+            uint32_t j = i;
+            while (j && children[order[j - 1]].distance < child->distance) {
+                order[j] = order[j - 1];
+                --j;
+            }
+
+            order[j] = i;
+        }
+
+        for (uint32_t i = 0; i < 8; ++i) {
+            const NearestFrame *child = &children[order[i]];
+
+            if (count < k || child->distance < best[0].distance) {
+                stack[top++] = *child;
+            }
+        }
+    }
+
+    //  Unwind the heap into hits, nearest first.
+    for (uint32_t size = count; size; --size) {
+        hits[size - 1] = best[0];
+        hits[size - 1].distance = sqrtf(best[0].distance);
+        NearestSiftDown(best, size - 1, &best[size - 1]);
+    }
+
+    return count;
+}
+
+}
+
+#endif
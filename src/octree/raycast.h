@@ -0,0 +1,177 @@
+#ifndef OCTREE_RAYCAST_H
+#define OCTREE_RAYCAST_H
+
+#include "octree.h"
+#include "../math/math.h"
+
+namespace Octree {
+
+//  Parametric front-to-back traversal (Revelles et al., "An efficient
+//  parametric algorithm for octree traversal"). Work is done in "bit space",
+//  where every axis grows towards the half its child index bit selects
+//  (x, -y, z), and the ray is mirrored so that all direction components are
+//  positive. The mirror mask is xor-ed onto child indices to get back to the
+//  real ones.
+
+struct RayHit {
+    float t;
+    vec3 normal;
+    NodeIndex node;
+};
+
+struct RayFrame {
+    NodeIndex node;
+    float t0[3];
+    float t1[3];
+    uint32_t child;
+};
+
+const float RAY_EPSILON = 1e-20f;
+
+//  RayFrame::child values past the eight children.
+const uint32_t RAY_DONE = 8;
+const uint32_t RAY_ENTER = 9;
+
+//  Entry and exit parameters of the box at `center` with half size `half`
+//  for each axis, in mirrored bit space. Returns the mirror mask.
+uint32_t RaySetup(const vec3 center, float half, const vec3 origin, const vec3 dir, float t0[3], float t1[3])
+{
+    const float AXIS_SIGN[3] = {1, -1, 1};
+    uint32_t mask = 0;
+
+    for (size_t k = 0; k < 3; ++k) {
+        float o = AXIS_SIGN[k] * (origin[k] - center[k]);
+        float d = AXIS_SIGN[k] * dir[k];
+
+        if (d < 0) {
+            o = -o;
+            d = -d;
+            mask |= 1 << k;
+        }
+
+        d = d < RAY_EPSILON ? RAY_EPSILON : d;
+        t0[k] = (-half - o) / d;
+        t1[k] = (half - o) / d;
+    }
+
+    return mask;
+}
+
+//  First child hit inside a node, found from the plane the ray entered by.
+inline uint32_t RayFirstChild(const float t0[3], const float tm[3])
+{
+    uint32_t axis = t0[0] > t0[1] ? (t0[0] > t0[2] ? 0 : 2) : (t0[1] > t0[2] ? 1 : 2);
+    uint32_t child = 0;
+
+    for (uint32_t k = 0; k < 3; ++k) {
+        if (k != axis && tm[k] < t0[axis]) {
+            child |= 1 << k;
+        }
+    }
+
+    return child;
+}
+
+//  Sibling the ray moves into after leaving `child` by its nearest exit
+//  plane, or RAY_DONE when it leaves the parent.
+inline uint32_t RayNextChild(uint32_t child, const float t1[3])
+{
+    uint32_t axis = t1[0] < t1[1] ? (t1[0] < t1[2] ? 0 : 2) : (t1[1] < t1[2] ? 1 : 2);
+    return (child >> axis) & 1 ? RAY_DONE : child | (1 << axis);
+}
+
+inline void RayChildSpan(const RayFrame *frame, uint32_t child, float t0[3], float t1[3])
+{
+    for (uint32_t k = 0; k < 3; ++k) {
+        float tm = 0.5f * (frame->t0[k] + frame->t1[k]);
+
+        if ((child >> k) & 1) {
+            t0[k] = tm;
+            t1[k] = frame->t1[k];
+        } else {
+            t0[k] = frame->t0[k];
+            t1[k] = tm;
+        }
+    }
+}
+
+inline void RayReportHit(const float t0[3], const vec3 dir, NodeIndex node, RayHit *hit)
+{
+    uint32_t axis = t0[0] > t0[1] ? (t0[0] > t0[2] ? 0 : 2) : (t0[1] > t0[2] ? 1 : 2);
+
+    hit->t = t0[axis] > 0 ? t0[axis] : 0;
+    hit->normal[0] = hit->normal[1] = hit->normal[2] = 0;
+    hit->normal[axis] = dir[axis] > 0 ? -1.0f : 1.0f;
+    hit->node = node;
+}
+
+//  Finds the first leaf with a non-zero value along the ray. `t` is measured
+//  in multiples of `dir`, so it is a distance when `dir` is normalized.
+bool RayCast(Octree *octree, const vec3 origin, const vec3 dir, RayHit *hit)
+{
+    float half = octree->size / 2;
+    vec3 inv, min, max;
+    float tmin, tmax;
+
+    ray_inverse(inv, dir);
+    for (size_t k = 0; k < 3; ++k) {
+        min[k] = octree->center[k] - half;
+        max[k] = octree->center[k] + half;
+    }
+
+    if (!intersect_aabb(origin, inv, min, max, &tmin, &tmax) || tmax < 0) {
+        return false;
+    }
+
+    RayFrame stack[MAX_DEPTH + 1];
+    RayFrame *top = stack;
+
+    top->node = 0;
+    top->child = RAY_ENTER;
+    uint32_t mask = RaySetup(octree->center, half, origin, dir, top->t0, top->t1);
+
+    for (;;) {
+        if (top->child == RAY_ENTER) {
+            top->child = RAY_DONE;
+
+            if (top->t1[0] < 0 || top->t1[1] < 0 || top->t1[2] < 0) {
+                // Behind the origin.
+            } else if (!HasChildren(octree, top->node)) {
+                if (GetNode(octree, top->node)->value) {
+                    RayReportHit(top->t0, dir, top->node, hit);
+                    return true;
+                }
+            } else {
+                float tm[3];
+                for (uint32_t k = 0; k < 3; ++k) {
+                    tm[k] = 0.5f * (top->t0[k] + top->t1[k]);
+                }
+
+                top->child = RayFirstChild(top->t0, tm);
+            }
+        }
+
+        if (top->child == RAY_DONE) {
+            if (top == stack) {
+                return false;
+            }
+
+            --top;
+            continue;
+        }
+
+        RayFrame *next = top + 1;
+        uint32_t child = top->child;
+
+        RayChildSpan(top, child, next->t0, next->t1);
+        next->node = GetNode(octree, top->node)->children[child ^ mask];
+        next->child = RAY_ENTER;
+
+        top->child = RayNextChild(child, next->t1);
+        top = next;
+    }
+}
+
+}
+
+#endif
@@ -0,0 +1,423 @@
+#ifndef OCTREE_SNAPSHOT_H
+#define OCTREE_SNAPSHOT_H
+
+#include <stdlib.h>
+#include <atomic>
+
+#include "octree.h"
+
+namespace Octree {
+
+//  Copy-on-write snapshots for one editing thread and any number of readers.
+//
+//  Published nodes are never written again. An edit copies the nodes on the
+//  path down to what it changes, shares every other subtree with the
+//  previous version and publishes the new root with a single atomic store,
+//  so readers always see a whole version and never wait for the editor.
+//
+//  Nodes a new version no longer reaches are retired with the current
+//  epoch, and the epoch moves on after each publish. A reader announces the
+//  epoch it entered at before it loads the root, and retired nodes are only
+//  put back on the free list once every reader entered at a later epoch,
+//  so the editor never waits for readers either.
+//
+//  A node can sit under many parents here, so parent links and dirty flags
+//  are not kept up: FindNeighbour and VisitDirty don't work on snapshots.
+//  Hermite data is shared along with its leaf and retired with it.
+
+const uint32_t MAX_READERS = 16;
+
+//  Reader slot states above any real epoch, so they never hold back
+//  reclamation.
+const uint64_t READER_FREE = UINT64_MAX;
+const uint64_t READER_IDLE = UINT64_MAX - 1;
+
+struct Retired {
+    NodeIndex index;
+    bool hermite;
+    uint64_t epoch;
+};
+
+//  A version as readers see it: the root in `tree` and a number that grows
+//  with every publish, usable like Octree::generation.
+struct Snapshot {
+    NodeIndex root;
+    uint32_t version;
+};
+
+//  `current` packs the published version and root into one word, and the
+//  editor keeps its own copy of both in `root` and `version`.
+struct SnapshotOctree {
+    Octree tree;
+    NodeIndex root;
+    uint32_t version;
+    std::atomic<uint64_t> current;
+    std::atomic<uint64_t> epoch;
+    std::atomic<uint64_t> readers[MAX_READERS];
+    Retired *retired;
+    size_t retired_head;
+    size_t retired_count;
+    size_t retired_capacity;
+};
+
+static_assert(sizeof(NodeIndex) <= sizeof(uint32_t), "Snapshots pack the root into 32 bits.");
+
+void SnapshotInit(SnapshotOctree *s)
+{
+    Init(&s->tree);
+    s->root = 0;
+    s->version = 0;
+    s->current.store(0);
+    s->epoch.store(1);
+
+    for (uint32_t i = 0; i < MAX_READERS; ++i) {
+        s->readers[i].store(READER_FREE);
+    }
+
+    s->retired = nullptr;
+    s->retired_head = 0;
+    s->retired_count = 0;
+    s->retired_capacity = 0;
+}
+
+//  Claims a reader slot for a thread. Fails with MAX_READERS when all are
+//  taken.
+uint32_t SnapshotRegister(SnapshotOctree *s)
+{
+    for (uint32_t i = 0; i < MAX_READERS; ++i) {
+        uint64_t expected = READER_FREE;
+
+        if (s->readers[i].compare_exchange_strong(expected, READER_IDLE)) {
+            return i;
+        }
+    }
+
+    return MAX_READERS;
+}
+
+void SnapshotUnregister(SnapshotOctree *s, uint32_t slot)
+{
+    s->readers[slot].store(READER_FREE);
+}
+
+//  Latest version. Its nodes stay valid until SnapshotRelease, however
+//  many versions the editor publishes meanwhile.
+Snapshot SnapshotAcquire(SnapshotOctree *s, uint32_t slot)
+{
+    s->readers[slot].store(s->epoch.load());
+    uint64_t current = s->current.load();
+
+    return {(NodeIndex)(current & 0xffffffff), (uint32_t)(current >> 32)};
+}
+
+void SnapshotRelease(SnapshotOctree *s, uint32_t slot)
+{
+    s->readers[slot].store(READER_IDLE);
+}
+
+static void Retire(SnapshotOctree *s, NodeIndex index, bool hermite)
+{
+    // The first root and Hermite slot 0 are never freed.
+    if (!index) {
+        return;
+    }
+
+    if (s->retired_count == s->retired_capacity) {
+        s->retired_capacity = s->retired_capacity ? 2 * s->retired_capacity : BLOCK_SIZE;
+        s->retired = (Retired *)realloc(s->retired, s->retired_capacity * sizeof(Retired));
+    }
+
+    s->retired[s->retired_count++] = {index, hermite, s->epoch.load(std::memory_order_relaxed)};
+}
+
+static void RetireSubtree(SnapshotOctree *s, NodeIndex node)
+{
+    OctreeNode *n = GetNode(&s->tree, node);
+
+    if (HasChildren(n)) {
+        for (size_t i = 0; i < 8; ++i) {
+            RetireSubtree(s, n->children[i]);
+        }
+    }
+
+    Retire(s, n->data, true);
+    Retire(s, node, false);
+}
+
+//  Frees what was retired before the oldest epoch a reader is still in.
+//  The list is in epoch order, so that is always a prefix of it.
+static void Reclaim(SnapshotOctree *s)
+{
+    uint64_t oldest = UINT64_MAX;
+
+    for (uint32_t i = 0; i < MAX_READERS; ++i) {
+        uint64_t epoch = s->readers[i].load();
+        oldest = epoch < oldest ? epoch : oldest;
+    }
+
+    Octree *octree = &s->tree;
+
+    for (; s->retired_head < s->retired_count; ++s->retired_head) {
+        Retired *r = &s->retired[s->retired_head];
+
+        if (r->epoch >= oldest) {
+            break;
+        }
+
+        if (r->hermite) {
+            FreeHermite(octree, r->index);
+        } else {
+            OctreeNode *n = GetNode(octree, r->index);
+            *n = {};
+            n->parent = octree->free_nodes;
+            octree->free_nodes = r->index;
+            octree->free_count++;
+        }
+    }
+
+    if (s->retired_head == s->retired_count) {
+        s->retired_head = 0;
+        s->retired_count = 0;
+    } else if (s->retired_head > s->retired_count / 2) {
+        s->retired_count -= s->retired_head;
+        memmove(s->retired, s->retired + s->retired_head, s->retired_count * sizeof(Retired));
+        s->retired_head = 0;
+    }
+}
+
+//  Makes `root` the version readers pick up, then reclaims what no reader
+//  can reach anymore.
+static void Publish(SnapshotOctree *s, NodeIndex root)
+{
+    s->root = root;
+    s->version++;
+    s->current.store((uint64_t)s->version << 32 | root);
+    s->epoch.fetch_add(1);
+
+    NextGeneration(&s->tree);
+    Reclaim(s);
+}
+
+//  Copy of a published node for the next version, retiring the original.
+static NodeIndex CopyNode(SnapshotOctree *s, NodeIndex node)
+{
+    NodeIndex copy = AllocNode(&s->tree);
+
+    *GetNode(&s->tree, copy) = *GetNode(&s->tree, node);
+    Retire(s, node, false);
+
+    return copy;
+}
+
+//  Splits a leaf of the next version. Its children are new, so the path
+//  below needs no more copies.
+static void SplitCopy(SnapshotOctree *s, NodeIndex node)
+{
+    SplitNode(&s->tree, node);
+
+    OctreeNode *n = GetNode(&s->tree, node);
+
+    for (size_t i = 0; i < 8; ++i) {
+        GetNode(&s->tree, n->children[i])->value = n->value;
+    }
+
+    Retire(s, n->data, true);
+    n->data = 0;
+    n->value = 0;
+}
+
+//  InsertPoint on a new version. Returns false, publishing nothing, when p
+//  already lies in a full leaf.
+bool SnapshotInsertPoint(SnapshotOctree *s, const vec3 p, uint16_t max_depth)
+{
+    Octree *octree = &s->tree;
+    NodeIndex node = s->root;
+    vec3 c;
+    memcpy(c, octree->center, sizeof(vec3));
+    float scale = octree->size / 4;
+
+    for (uint16_t depth = 0; depth <= max_depth; ++depth) {
+        OctreeNode *n = GetNode(octree, node);
+
+        if (n->value == 0xffff && (depth == max_depth || !HasChildren(n))) {
+            return false;
+        }
+
+        if (depth == max_depth || !HasChildren(n)) {
+            break;
+        }
+
+        uint32_t i = ChildIndex(c, p);
+
+        vec3 offset;
+        vec3_scale(offset, CHILDREN_CENTER_OFFSET[i], 2 * scale);
+        vec3_add(c, c, offset);
+        scale *= 0.5f;
+
+        node = n->children[i];
+    }
+
+    NodeIndex root = CopyNode(s, s->root);
+    bool fresh = false;
+
+    node = root;
+    memcpy(c, octree->center, sizeof(vec3));
+    scale = octree->size / 4;
+
+    for (uint16_t depth = 0; depth < max_depth; ++depth) {
+        if (!HasChildren(octree, node)) {
+            SplitCopy(s, node);
+            fresh = true;
+        }
+
+        uint32_t i = ChildIndex(c, p);
+
+        vec3 offset;
+        vec3_scale(offset, CHILDREN_CENTER_OFFSET[i], 2 * scale);
+        vec3_add(c, c, offset);
+        scale *= 0.5f;
+
+        OctreeNode *n = GetNode(octree, node);
+
+        if (!fresh) {
+            n->children[i] = CopyNode(s, n->children[i]);
+        }
+
+        node = n->children[i];
+    }
+
+    GetNode(octree, node)->value = 0xffff;
+
+    Publish(s, root);
+    return true;
+}
+
+//  RemovePoint on a new version, collapsing the path back up where the
+//  siblings became uniform. Returns false, publishing nothing, when p
+//  already lies in an empty leaf.
+bool SnapshotRemovePoint(SnapshotOctree *s, const vec3 p, uint16_t max_depth)
+{
+    assert(max_depth <= MAX_DEPTH);
+
+    Octree *octree = &s->tree;
+    NodeIndex node = s->root;
+    vec3 c;
+    memcpy(c, octree->center, sizeof(vec3));
+    float scale = octree->size / 4;
+
+    for (uint16_t depth = 0; depth < max_depth; ++depth) {
+        OctreeNode *n = GetNode(octree, node);
+
+        if (!HasChildren(n)) {
+            if (!n->value) {
+                return false;
+            }
+
+            break;
+        }
+
+        uint32_t i = ChildIndex(c, p);
+
+        vec3 offset;
+        vec3_scale(offset, CHILDREN_CENTER_OFFSET[i], 2 * scale);
+        vec3_add(c, c, offset);
+        scale *= 0.5f;
+
+        node = n->children[i];
+    }
+
+    {
+        OctreeNode *n = GetNode(octree, node);
+
+        if (!HasChildren(n) && !n->value) {
+            return false;
+        }
+    }
+
+    NodeIndex path[MAX_DEPTH];
+    NodeIndex root = CopyNode(s, s->root);
+    bool fresh = false;
+    uint16_t depth = 0;
+
+    node = root;
+    memcpy(c, octree->center, sizeof(vec3));
+    scale = octree->size / 4;
+
+    for (; depth < max_depth; ++depth) {
+        if (!HasChildren(octree, node)) {
+            SplitCopy(s, node);
+            fresh = true;
+        }
+
+        uint32_t i = ChildIndex(c, p);
+
+        vec3 offset;
+        vec3_scale(offset, CHILDREN_CENTER_OFFSET[i], 2 * scale);
+        vec3_add(c, c, offset);
+        scale *= 0.5f;
+
+        OctreeNode *n = GetNode(octree, node);
+
+        if (!fresh) {
+            n->children[i] = CopyNode(s, n->children[i]);
+        }
+
+        path[depth] = node;
+        node = n->children[i];
+    }
+
+    OctreeNode *leaf = GetNode(octree, node);
+
+    if (HasChildren(leaf)) {
+        for (size_t i = 0; i < 8; ++i) {
+            RetireSubtree(s, leaf->children[i]);
+            leaf->children[i] = 0;
+        }
+    }
+
+    Retire(s, leaf->data, true);
+    leaf->data = 0;
+    leaf->value = 0;
+
+    //  Same test as CollapseNode. The children are retired rather than
+    //  freed, since all but the one on the path may be shared.
+    while (depth > 0) {
+        OctreeNode *n = GetNode(octree, path[--depth]);
+        NodeValue value = GetNode(octree, n->children[0])->value;
+        bool uniform = true;
+
+        for (size_t i = 0; i < 8 && uniform; ++i) {
+            OctreeNode *child = GetNode(octree, n->children[i]);
+            uniform = !HasChildren(child) && !child->data && child->value == value;
+        }
+
+        if (!uniform) {
+            break;
+        }
+
+        for (size_t i = 0; i < 8; ++i) {
+            Retire(s, n->children[i], false);
+            n->children[i] = 0;
+        }
+
+        n->value = value;
+    }
+
+    Publish(s, root);
+    return true;
+}
+
+//  Frees every node, retired or not. No reader may still be in.
+void SnapshotCleanup(SnapshotOctree *s)
+{
+    Cleanup(&s->tree);
+    free(s->retired);
+    s->retired = nullptr;
+    s->retired_head = 0;
+    s->retired_count = 0;
+    s->retired_capacity = 0;
+}
+
+}
+
+#endif
@@ -0,0 +1,361 @@
+#ifndef RENDERER_ALLOCATOR_H
+#define RENDERER_ALLOCATOR_H
+
+#include <vulkan/vulkan.h>
+#include <stdlib.h>
+#include <string.h>
+
+//  Device memory suballocator. Memory is taken from the driver in large
+//  blocks, one list of blocks per memory type, and buffers are carved out of
+//  them first fit, so a handful of vkAllocateMemory calls serve any number
+//  of buffers. Each block keeps its free ranges sorted by offset and merges
+//  them back together on free. A block that empties is kept while it is
+//  the only empty one of its memory type, so a buffer created and destroyed
+//  over and over doesn't allocate a fresh block each time; further empty
+//  blocks and dedicated ones go back to the driver.
+//
+//  Host visible blocks are mapped for their whole life, since one
+//  VkDeviceMemory can't be mapped twice at once, and every allocation in
+//  them gets its own pointer into that mapping.
+//
+//  Only needs a VkDevice, so it runs on a headless or software device
+//  (lavapipe) as well as under the renderer.
+
+const VkDeviceSize ALLOCATOR_BLOCK_SIZE = 64 * 1024 * 1024;
+
+struct MemoryRange {
+    VkDeviceSize offset;
+    VkDeviceSize size;
+};
+
+//  A block with no memory is an unused slot. A dedicated block was made
+//  for one large allocation.
+struct MemoryBlock {
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    VkDeviceSize used;
+    uint32_t type;
+    uint32_t allocations;
+    bool dedicated;
+    void *mapped;
+    MemoryRange *free;
+    uint32_t free_count;
+    uint32_t free_capacity;
+};
+
+struct Allocation {
+    VkDeviceMemory memory;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    uint32_t block;
+    void *mapped;
+};
+
+struct Allocator {
+    VkDevice device;
+    VkPhysicalDeviceMemoryProperties properties;
+    VkDeviceSize block_size;
+    MemoryBlock *blocks;
+    uint32_t block_count;
+};
+
+//  `fragmentation` is the share of free space outside the largest free
+//  range: 0 when all free space is in one piece.
+struct AllocatorStats {
+    uint32_t blocks;
+    uint32_t allocations;
+    VkDeviceSize reserved;
+    VkDeviceSize used;
+    VkDeviceSize largest_free;
+    float fragmentation;
+};
+
+void allocator_init(Allocator *allocator, VkPhysicalDevice physical_device, VkDevice device, VkDeviceSize block_size = ALLOCATOR_BLOCK_SIZE)
+{
+    allocator->device = device;
+    vkGetPhysicalDeviceMemoryProperties(physical_device, &allocator->properties);
+    allocator->block_size = block_size;
+    allocator->blocks = nullptr;
+    allocator->block_count = 0;
+}
+
+//  First memory type in `filter` with all of `properties`, or UINT32_MAX.
+uint32_t allocator_memory_type(Allocator *allocator, uint32_t filter, VkMemoryPropertyFlags properties)
+{
+    for (uint32_t i = 0; i < allocator->properties.memoryTypeCount; ++i) {
+        if ((filter & (1 << i)) && (allocator->properties.memoryTypes[i].propertyFlags & properties) == properties) {
+            return i;
+        }
+    }
+
+    return UINT32_MAX;
+}
+
+static void block_insert_range(MemoryBlock *block, uint32_t at, VkDeviceSize offset, VkDeviceSize size)
+{
+    if (block->free_count == block->free_capacity) {
+        block->free_capacity = block->free_capacity ? 2 * block->free_capacity : 16;
+        block->free = (MemoryRange *)realloc(block->free, block->free_capacity * sizeof(MemoryRange));
+    }
+
+    memmove(&block->free[at + 1], &block->free[at], (block->free_count - at) * sizeof(MemoryRange));
+    block->free[at] = {offset, size};
+    block->free_count++;
+}
+
+static void block_remove_range(MemoryBlock *block, uint32_t at)
+{
+    block->free_count--;
+    memmove(&block->free[at], &block->free[at + 1], (block->free_count - at) * sizeof(MemoryRange));
+}
+
+//  Takes `size` bytes at an `alignment` multiple from the first free range
+//  they fit in. The padding in front stays free.
+static bool block_carve(MemoryBlock *block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize *offset)
+{
+    for (uint32_t i = 0; i < block->free_count; ++i) {
+        MemoryRange range = block->free[i];
+        VkDeviceSize start = (range.offset + alignment - 1) / alignment * alignment;
+
+        if (start + size > range.offset + range.size) {
+            continue;
+        }
+
+        VkDeviceSize end = range.offset + range.size;
+        block_remove_range(block, i);
+
+        if (end > start + size) {
+            block_insert_range(block, i, start + size, end - start - size);
+        }
+
+        if (start > range.offset) {
+            block_insert_range(block, i, range.offset, start - range.offset);
+        }
+
+        block->used += size;
+        block->allocations++;
+        *offset = start;
+        return true;
+    }
+
+    return false;
+}
+
+static bool allocator_new_block(Allocator *allocator, uint32_t type, VkDeviceSize size, bool dedicated, uint32_t *index)
+{
+    uint32_t slot = 0;
+    while (slot < allocator->block_count && allocator->blocks[slot].memory != VK_NULL_HANDLE) {
+        ++slot;
+    }
+
+    if (slot == allocator->block_count) {
+        allocator->block_count++;
+        allocator->blocks = (MemoryBlock *)realloc(allocator->blocks, allocator->block_count * sizeof(MemoryBlock));
+        allocator->blocks[slot] = {};
+    }
+
+    MemoryBlock *block = &allocator->blocks[slot];
+
+    VkMemoryAllocateInfo alloc_info = {};
+    alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    alloc_info.allocationSize = size;
+    alloc_info.memoryTypeIndex = type;
+
+    VkResult result = vkAllocateMemory(allocator->device, &alloc_info, nullptr, &block->memory);
+    check_vulkan_result(result, "Failed to allocate memory block.");
+
+    if (result != VK_SUCCESS) {
+        block->memory = VK_NULL_HANDLE;
+        return false;
+    }
+
+    block->size = size;
+    block->used = 0;
+    block->type = type;
+    block->allocations = 0;
+    block->dedicated = dedicated;
+    block->mapped = nullptr;
+    block->free_count = 0;
+    block_insert_range(block, 0, 0, size);
+
+    if (allocator->properties.memoryTypes[type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        result = vkMapMemory(allocator->device, block->memory, 0, VK_WHOLE_SIZE, 0, &block->mapped);
+        check_vulkan_result(result, "Failed to map memory block.");
+    }
+
+    *index = slot;
+    return true;
+}
+
+//  Suballocates memory meeting `requirements` with `properties`. Requests
+//  over half a block get a block of their own.
+bool allocator_alloc(Allocator *allocator, const VkMemoryRequirements *requirements, VkMemoryPropertyFlags properties, Allocation *allocation)
+{
+    uint32_t type = allocator_memory_type(allocator, requirements->memoryTypeBits, properties);
+    if (type == UINT32_MAX) {
+        fmt::print("assert failed: {}", "No memory type for allocation.");
+        return false;
+    }
+
+    VkDeviceSize size = requirements->size;
+    VkDeviceSize alignment = requirements->alignment ? requirements->alignment : 1;
+    VkDeviceSize offset;
+    uint32_t index = 0;
+    bool found = false;
+
+    if (size <= allocator->block_size / 2) {
+        for (uint32_t i = 0; i < allocator->block_count && !found; ++i) {
+            MemoryBlock *block = &allocator->blocks[i];
+
+            if (block->memory != VK_NULL_HANDLE && block->type == type && block_carve(block, size, alignment, &offset)) {
+                index = i;
+                found = true;
+            }
+        }
+    }
+
+    if (!found) {
+        VkDeviceSize heap_size = allocator->properties.memoryHeaps[allocator->properties.memoryTypes[type].heapIndex].size;
+        VkDeviceSize block_size = allocator->block_size < heap_size / 8 ? allocator->block_size : heap_size / 8;
+
+        bool dedicated = size > block_size / 2;
+
+        if (!allocator_new_block(allocator, type, dedicated ? size : block_size, dedicated, &index)) {
+            return false;
+        }
+
+        block_carve(&allocator->blocks[index], size, alignment, &offset);
+    }
+
+    MemoryBlock *block = &allocator->blocks[index];
+
+    allocation->memory = block->memory;
+    allocation->offset = offset;
+    allocation->size = size;
+    allocation->block = index;
+    allocation->mapped = block->mapped ? (char *)block->mapped + offset : nullptr;
+
+    return true;
+}
+
+//  Whether a block that just emptied should stay around for the next
+//  allocation of its type.
+static bool allocator_keep_block(Allocator *allocator, uint32_t index)
+{
+    MemoryBlock *block = &allocator->blocks[index];
+
+    if (block->dedicated) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < allocator->block_count; ++i) {
+        MemoryBlock *other = &allocator->blocks[i];
+
+        if (i != index && other->memory != VK_NULL_HANDLE && other->type == block->type && !other->allocations) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void allocator_free(Allocator *allocator, Allocation *allocation)
+{
+    if (allocation->memory == VK_NULL_HANDLE) {
+        return;
+    }
+
+    MemoryBlock *block = &allocator->blocks[allocation->block];
+    VkDeviceSize offset = allocation->offset;
+    VkDeviceSize end = offset + allocation->size;
+
+    uint32_t at = 0;
+    while (at < block->free_count && block->free[at].offset < offset) {
+        ++at;
+    }
+
+    bool before = at > 0 && block->free[at - 1].offset + block->free[at - 1].size == offset;
+    bool after = at < block->free_count && block->free[at].offset == end;
+
+    if (before && after) {
+        block->free[at - 1].size += allocation->size + block->free[at].size;
+        block_remove_range(block, at);
+    } else if (before) {
+        block->free[at - 1].size += allocation->size;
+    } else if (after) {
+        block->free[at].offset = offset;
+        block->free[at].size += allocation->size;
+    } else {
+        block_insert_range(block, at, offset, allocation->size);
+    }
+
+    block->used -= allocation->size;
+    block->allocations--;
+
+    if (!block->allocations && !allocator_keep_block(allocator, allocation->block)) {
+        if (block->mapped) {
+            vkUnmapMemory(allocator->device, block->memory);
+        }
+
+        vkFreeMemory(allocator->device, block->memory, nullptr);
+        block->memory = VK_NULL_HANDLE;
+        block->mapped = nullptr;
+        block->free_count = 0;
+    }
+
+    *allocation = {};
+}
+
+AllocatorStats allocator_stats(Allocator *allocator)
+{
+    AllocatorStats stats = {};
+    VkDeviceSize free_size = 0;
+
+    for (uint32_t i = 0; i < allocator->block_count; ++i) {
+        MemoryBlock *block = &allocator->blocks[i];
+
+        if (block->memory == VK_NULL_HANDLE) {
+            continue;
+        }
+
+        stats.blocks++;
+        stats.allocations += block->allocations;
+        stats.reserved += block->size;
+        stats.used += block->used;
+
+        for (uint32_t r = 0; r < block->free_count; ++r) {
+            free_size += block->free[r].size;
+
+            if (block->free[r].size > stats.largest_free) {
+                stats.largest_free = block->free[r].size;
+            }
+        }
+    }
+
+    stats.fragmentation = free_size ? 1.f - (float)stats.largest_free / free_size : 0.f;
+    return stats;
+}
+
+//  Gives every block back. Nothing allocated from it may still be in use.
+void allocator_cleanup(Allocator *allocator)
+{
+    for (uint32_t i = 0; i < allocator->block_count; ++i) {
+        MemoryBlock *block = &allocator->blocks[i];
+
+        if (block->memory != VK_NULL_HANDLE) {
+            if (block->mapped) {
+                vkUnmapMemory(allocator->device, block->memory);
+            }
+
+            vkFreeMemory(allocator->device, block->memory, nullptr);
+        }
+
+        free(block->free);
+    }
+
+    free(allocator->blocks);
+    allocator->blocks = nullptr;
+    allocator->block_count = 0;
+}
+
+#endif
@@ -8,32 +8,53 @@
 
 struct VertexBuffer {
     VkBuffer buffer;
-    VkDeviceMemory memory;
+    Allocation allocation;
 };
 
-struct UniformBuffer {
+//  Vertex buffer with one host visible copy per swapchain image, mapped for
+//  its whole life, so the CPU can write a frame's vertices in place while
+//  other frames are still being drawn from the other copies. Each copy
+//  grows on its own, when its frame needs more.
+struct DynamicVertexBuffer {
     uint32_t count;
+    VkDeviceSize *sizes;
     VkBuffer *buffers;
-    VkDeviceMemory *memories;
-    void ** mapped;
+    Allocation *allocations;
 };
 
-static uint32_t find_memory_type(Renderer *renderer, uint32_t filter, VkMemoryPropertyFlags properties);
-static void create_buffer(Renderer *renderer, VkBuffer *buffer, VkDeviceMemory *memory, VkDeviceSize size, VkBufferUsageFlags type, VkMemoryPropertyFlags props);
+//  Chain of host visible buffers, each mapped once and split into a region
+//  per frame in flight. Vertices that only live for one frame are written
+//  into ranges of the current frame's regions and drawn with the range's
+//  offset; a region is only reused once begin_frame has waited for the
+//  frame that last drew from it. A frame that outgrows the chain adds a
+//  buffer to it, and buffers are never dropped, so the chain settles at
+//  what the busiest frame needed.
+struct FrameRing {
+    VkDeviceSize region_size;
+    uint32_t count;
+    VkBuffer *buffers;
+    Allocation *allocations;
+    uint32_t current;
+    VkDeviceSize offset;
+    uint32_t frame;
+};
 
-static uint32_t find_memory_type(Renderer *renderer, uint32_t filter, VkMemoryPropertyFlags properties)
-{
-    VkPhysicalDeviceMemoryProperties mem_properties;
-    vkGetPhysicalDeviceMemoryProperties(renderer->physical_device, &mem_properties);
+//  Offset is for vkCmdBindVertexBuffers, data is where to write.
+struct FrameRange {
+    VkBuffer buffer;
+    VkDeviceSize offset;
+    void *data;
+};
 
-    for (uint32_t i = 0; i < mem_properties.memoryTypeCount; ++i) {
-        if ((filter & (1 << i)) && (mem_properties.memoryTypes[i].propertyFlags & properties) == properties) {
-            return i;
-        }
-    }
-}
+struct UniformBuffer {
+    uint32_t count;
+    VkBuffer *buffers;
+    Allocation *allocations;
+};
 
-static void create_buffer(Renderer *renderer, VkBuffer *buffer, VkDeviceMemory *memory, VkDeviceSize size, VkBufferUsageFlags type, VkMemoryPropertyFlags props)
+//  Buffer bound to memory from the renderer's allocator. Host visible
+//  memory comes back already mapped, at allocation->mapped.
+static void create_buffer(Renderer *renderer, VkBuffer *buffer, Allocation *allocation, VkDeviceSize size, VkBufferUsageFlags type, VkMemoryPropertyFlags props)
 {
     VkResult result;
 
@@ -49,34 +70,148 @@ static void create_buffer(Renderer *renderer, VkBuffer *buffer, VkDeviceMemory *
     VkMemoryRequirements mem_requirements;
     vkGetBufferMemoryRequirements(renderer->device, *buffer, &mem_requirements);
 
-    VkMemoryAllocateInfo alloc_info = {};
-    alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    alloc_info.allocationSize = mem_requirements.size;
-    alloc_info.memoryTypeIndex = find_memory_type(
-        renderer, 
-        mem_requirements.memoryTypeBits, 
-        props
-    );
-
-    result = vkAllocateMemory(renderer->device, &alloc_info, nullptr, memory);
-    check_vulkan_result(result, "Failed to allocate buffer memory.");   
+    if (!allocator_alloc(&renderer->allocator, &mem_requirements, props, allocation)) {
+        *allocation = {};
+        return;
+    }
 
-    result = vkBindBufferMemory(renderer->device, *buffer, *memory, 0);
+    result = vkBindBufferMemory(renderer->device, *buffer, allocation->memory, allocation->offset);
     check_vulkan_result(result, "Failed to bind buffer memory.");
 }
 
+//  The GPU must be done with the buffer.
+static void destroy_buffer(Renderer *renderer, VkBuffer buffer, Allocation *allocation)
+{
+    vkDestroyBuffer(renderer->device, buffer, nullptr);
+    allocator_free(&renderer->allocator, allocation);
+}
+
 void create_vertex_buffer(Renderer *renderer, VertexBuffer *buffer, VkDeviceSize size)
 {
-    create_buffer(renderer, &buffer->buffer, &buffer->memory, size, 
+    create_buffer(renderer, &buffer->buffer, &buffer->allocation, size, 
         VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 }
 
 void fill_vertex_buffer(Renderer *renderer, VertexBuffer *buffer, void *data, size_t size)
 {
-    void *gpu_data;
-    vkMapMemory(renderer->device, buffer->memory, 0, size, 0, &gpu_data);
-    memcpy(gpu_data, data, size);
-    vkUnmapMemory(renderer->device, buffer->memory);
+    memcpy(buffer->allocation.mapped, data, size);
+}
+
+void destroy_vertex_buffer(Renderer *renderer, VertexBuffer *buffer)
+{
+    destroy_buffer(renderer, buffer->buffer, &buffer->allocation);
+    buffer->buffer = VK_NULL_HANDLE;
+}
+
+void create_dynamic_vertex_buffer(Renderer *renderer, DynamicVertexBuffer *buffer, VkDeviceSize size)
+{
+    buffer->count = renderer->image_count;
+
+    buffer->sizes = (VkDeviceSize *)malloc(sizeof(VkDeviceSize) * buffer->count);
+    buffer->buffers = (VkBuffer *)malloc(sizeof(VkBuffer) * buffer->count);
+    buffer->allocations = (Allocation *)malloc(sizeof(Allocation) * buffer->count);
+
+    for (size_t i = 0; i < buffer->count; ++i) {
+        buffer->sizes[i] = size;
+        create_buffer(renderer, &buffer->buffers[i], &buffer->allocations[i], size,
+            VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    }
+}
+
+//  Makes the copy of the current frame hold at least `size` bytes, at least
+//  doubling it when it has to grow. Its contents are lost when it does.
+//  Like writing the copy, only safe between begin_frame and submit_frame.
+void dynamic_vertex_buffer_reserve(Renderer *renderer, DynamicVertexBuffer *buffer, VkDeviceSize size)
+{
+    uint32_t frame = renderer->frame_index;
+
+    if (buffer->sizes[frame] >= size) {
+        return;
+    }
+
+    VkDeviceSize grown = 2 * buffer->sizes[frame];
+    buffer->sizes[frame] = grown > size ? grown : size;
+
+    destroy_buffer(renderer, buffer->buffers[frame], &buffer->allocations[frame]);
+    create_buffer(renderer, &buffer->buffers[frame], &buffer->allocations[frame], buffer->sizes[frame],
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+}
+
+VkDeviceSize dynamic_vertex_buffer_size(Renderer *renderer, DynamicVertexBuffer *buffer)
+{
+    return buffer->sizes[renderer->frame_index];
+}
+
+//  Copy of the current frame. Only safe to write between begin_frame and
+//  submit_frame, once the image it belongs to is no longer in flight.
+void * dynamic_vertex_buffer_data(Renderer *renderer, DynamicVertexBuffer *buffer)
+{
+    return buffer->allocations[renderer->frame_index].mapped;
+}
+
+VkBuffer dynamic_vertex_buffer_current(Renderer *renderer, DynamicVertexBuffer *buffer)
+{
+    return buffer->buffers[renderer->frame_index];
+}
+
+static void frame_ring_grow(Renderer *renderer, FrameRing *ring)
+{
+    uint32_t i = ring->count++;
+
+    ring->buffers = (VkBuffer *)realloc(ring->buffers, sizeof(VkBuffer) * ring->count);
+    ring->allocations = (Allocation *)realloc(ring->allocations, sizeof(Allocation) * ring->count);
+
+    create_buffer(renderer, &ring->buffers[i], &ring->allocations[i], ring->region_size * FRAMES_IN_FLIGHT,
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+}
+
+void create_frame_ring(Renderer *renderer, FrameRing *ring, VkDeviceSize region_size)
+{
+    ring->region_size = region_size;
+    ring->count = 0;
+    ring->buffers = nullptr;
+    ring->allocations = nullptr;
+    ring->current = 0;
+    ring->offset = 0;
+    ring->frame = 0;
+
+    frame_ring_grow(renderer, ring);
+}
+
+//  Starts handing out the current frame's regions. Call after begin_frame.
+void frame_ring_begin(Renderer *renderer, FrameRing *ring)
+{
+    ring->frame = renderer->current_frame;
+    ring->current = 0;
+    ring->offset = 0;
+}
+
+//  Range of `size` bytes at an `alignment` multiple in this frame's
+//  regions, moving on to the next buffer of the chain, or adding one, when
+//  the current one is full. Fails only for more than a region's size.
+bool frame_ring_alloc(Renderer *renderer, FrameRing *ring, VkDeviceSize size, VkDeviceSize alignment, FrameRange *range)
+{
+    if (size > ring->region_size) {
+        return false;
+    }
+
+    VkDeviceSize start = (ring->offset + alignment - 1) / alignment * alignment;
+
+    if (start + size > ring->region_size) {
+        if (++ring->current == ring->count) {
+            frame_ring_grow(renderer, ring);
+        }
+
+        start = 0;
+    }
+
+    ring->offset = start + size;
+
+    range->buffer = ring->buffers[ring->current];
+    range->offset = ring->frame * ring->region_size + start;
+    range->data = (char *)ring->allocations[ring->current].mapped + range->offset;
+
+    return true;
 }
 
 void create_uniform_buffer(Renderer *renderer, UniformBuffer *uniform, VkDeviceSize size)
@@ -84,20 +219,17 @@ void create_uniform_buffer(Renderer *renderer, UniformBuffer *uniform, VkDeviceS
     uniform->count = renderer->image_count;
 
     uniform->buffers = (VkBuffer *)malloc(sizeof(VkBuffer) * uniform->count);
-    uniform->memories = (VkDeviceMemory *)malloc(sizeof(VkDeviceMemory) * uniform->count);
-    uniform->mapped = (void**)malloc(sizeof(void *) * uniform->count);
+    uniform->allocations = (Allocation *)malloc(sizeof(Allocation) * uniform->count);
 
     for (size_t i = 0; i < uniform->count; ++i) {
-        create_buffer(renderer, &uniform->buffers[i], &uniform->memories[i], size, 
+        create_buffer(renderer, &uniform->buffers[i], &uniform->allocations[i], size, 
             VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-        vkMapMemory(renderer->device, uniform->memories[i], 0, size, 0, &uniform->mapped[i]);
     }
 }
 
 void fill_uniform_mat4x4(Renderer *renderer, UniformBuffer *uniform, mat4x4 mat)
 {
-    memcpy(uniform->mapped[renderer->frame_index], mat, sizeof(float) * 16);
+    memcpy(uniform->allocations[renderer->frame_index].mapped, mat, sizeof(float) * 16);
 }
 
 #endif
\ No newline at end of file
@@ -18,7 +18,7 @@ void create_fpscamera(FPSCamera *camera, float fov, float aspect, float near, fl
     camera->far = far;
 }
 
-void fpscamera_rotation(FPSCamera *camera, float xrad, float yrad, quat rot)
+void fpscamera_rotation(FPSCamera *, float xrad, float yrad, quat rot)
 {
     quat xrot;
     quat zrot;
@@ -29,6 +29,14 @@ void fpscamera_rotation(FPSCamera *camera, float xrad, float yrad, quat rot)
     quat_mul(rot, zrot, xrot);
 }
 
+//  Pixels one unit covers at a distance of one unit along the view axis,
+//  on a target `height` pixels high. For the level of detail DebugLineList,
+//  which only bench_debug_view uses now.
+float fpscamera_pixel_scale(FPSCamera *camera, uint32_t height)
+{
+    return height / (2.f * tanf(camera->fov / 2));
+}
+
 void fpscamera_view(FPSCamera *camera, vec3 pos, quat rot, mat4x4 view)
 {
     mat4x4 proj;
@@ -35,6 +35,8 @@ void check_vulkan_result(VkResult &result, char *msg)
     }
 }
 
+#include "allocator.h"
+
 struct QueueFamilyIndices {
     uint32_t graphics;
     uint32_t present;
@@ -56,9 +58,12 @@ struct Renderer {
     VkPhysicalDevice physical_device;
 
     VkDevice device;
+    uint32_t graphics_family;
     VkQueue graphics_queue;
     VkQueue present_queue;
 
+    Allocator allocator;
+
     VkSwapchainKHR swapchain;
 
     uint32_t image_count;
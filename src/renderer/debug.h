@@ -2,71 +2,320 @@
 #define RENDERER_DEBUG_H
 
 #include "renderer.h"
+#include "debug_lines.h"
 #include "assert.h"
 
-struct DebugRenderer {
-    uint32_t count;
-    VertexBuffer buffer;
-    vec3 *verts;
+void debug_renderer_init(Renderer *, DebugRenderer *debug)
+{
+    debug_renderer_init_chunks(debug);
+}
+
+static void debug_renderer_draw(VkCommandBuffer cmdbuffer, FrameRange *range, uint32_t count)
+{
+    if (count) {
+        vkCmdBindVertexBuffers(cmdbuffer, 0, 1, &range->buffer, &range->offset);
+        vkCmdDraw(cmdbuffer, count, 1, 0, 0);
+    }
+}
+
+//  Copies each chunk into a range of this frame's part of `ring`, so frames
+//  still in flight keep theirs, and records the draws into `cmdbuffer` with
+//  whatever pipeline is bound. Chunks that land back to back in one ring
+//  buffer go out as a single draw. Returns the number of draws.
+uint32_t debug_renderer_flush(Renderer *renderer, DebugRenderer *debug, FrameRing *ring, VkCommandBuffer cmdbuffer)
+{
+    FrameRange draw = {};
+    uint32_t draw_count = 0;
+    uint32_t draws = 0;
+
+    for (uint32_t i = 0; i <= debug->chunk; ++i) {
+        uint32_t count = debug_renderer_chunk_size(debug, i);
+        FrameRange range;
+
+        if (!count || !frame_ring_alloc(renderer, ring, count * sizeof(vec3), sizeof(vec3), &range)) {
+            continue;
+        }
+
+        memcpy(range.data, debug->chunks[i], count * sizeof(vec3));
+
+        if (draw_count && range.buffer == draw.buffer && range.offset == draw.offset + draw_count * sizeof(vec3)) {
+            draw_count += count;
+            continue;
+        }
+
+        if (draw_count) {
+            debug_renderer_draw(cmdbuffer, &draw, draw_count);
+            draws++;
+        }
+
+        draw = range;
+        draw_count = count;
+    }
+
+    if (draw_count) {
+        debug_renderer_draw(cmdbuffer, &draw, draw_count);
+        draws++;
+    }
+
+    debug_renderer_reset(debug);
+    return draws;
+}
+
+//  Spheres, boxes and cylinders, drawn as instances of unit line meshes
+//  built once at init into one device local buffer. An instance is only the
+//  top three rows of its transform and a colour, so a shape costs 64 bytes
+//  a frame however many lines its mesh has, and no trigonometry.
+enum DebugShape {
+    DEBUG_SPHERE,
+    DEBUG_BOX,
+    DEBUG_CYLINDER,
+    DEBUG_SHAPE_COUNT
+};
+
+struct DebugInstance {
+    vec4 rows[3];
+    vec4 color;
+};
+
+//  Instances are kept per shape like DebugRenderer keeps lines: arrays
+//  that only grow, so steady frames allocate nothing.
+struct DebugShapes {
+    Material material;
+    VertexBuffer mesh;
+    uint32_t first[DEBUG_SHAPE_COUNT];
+    uint32_t count[DEBUG_SHAPE_COUNT];
+    DebugInstance *instances[DEBUG_SHAPE_COUNT];
+    uint32_t instance_count[DEBUG_SHAPE_COUNT];
+    uint32_t instance_capacity[DEBUG_SHAPE_COUNT];
 };
 
-static const uint32_t DEFAULT_SIZE = 1024 * 16;
+static const uint32_t DEBUG_SHAPE_SEGMENTS = 32;
 
-void debug_renderer_init(Renderer *renderer, DebugRenderer *debug)
+//  Unit circle of radius 1 around `center`, in the plane of axes u and v.
+static void debug_unit_circle(vec3 *verts, uint32_t *n, uint32_t u, uint32_t v, const vec3 center)
 {
-    create_vertex_buffer(renderer, &debug->buffer, DEFAULT_SIZE * sizeof(vec3));
-    debug->verts = new vec3[DEFAULT_SIZE];
-    debug->count = 0;
+    float astep = 2.f * M_PI / DEBUG_SHAPE_SEGMENTS;
+
+    for (uint32_t i = 0; i < DEBUG_SHAPE_SEGMENTS; ++i) {
+        for (uint32_t k = 0; k < 2; ++k) {
+            float angle = astep * (i + k);
+            float *p = verts[(*n)++];
+
+            memcpy(p, center, sizeof(vec3));
+            p[u] += cosf(angle);
+            p[v] += sinf(angle);
+        }
+    }
 }
 
-void debug_renderer_drawline(DebugRenderer *debug, vec3 a, vec3 b)
+static void debug_unit_meshes(DebugShapes *shapes, vec3 *verts, uint32_t *n)
 {
-    memcpy(debug->verts[debug->count++], a, sizeof(vec3));
-    memcpy(debug->verts[debug->count++], b, sizeof(vec3));
+    static const vec3 origin = {0, 0, 0};
+    static const vec3 bottom = {0, 0, -1};
+    static const vec3 top = {0, 0, 1};
+
+    // Sphere of radius 1: three great circles.
+    shapes->first[DEBUG_SPHERE] = *n;
+    debug_unit_circle(verts, n, 0, 1, origin);
+    debug_unit_circle(verts, n, 0, 2, origin);
+    debug_unit_circle(verts, n, 1, 2, origin);
+    shapes->count[DEBUG_SPHERE] = *n - shapes->first[DEBUG_SPHERE];
+
+    // Box from -1 to 1: the 4 edges along each axis.
+    shapes->first[DEBUG_BOX] = *n;
+    for (uint32_t axis = 0; axis < 3; ++axis) {
+        for (uint32_t corner = 0; corner < 4; ++corner) {
+            for (uint32_t end = 0; end < 2; ++end) {
+                float *p = verts[(*n)++];
+
+                p[axis] = end ? 1.f : -1.f;
+                p[(axis + 1) % 3] = corner & 1 ? 1.f : -1.f;
+                p[(axis + 2) % 3] = corner & 2 ? 1.f : -1.f;
+            }
+        }
+    }
+    shapes->count[DEBUG_BOX] = *n - shapes->first[DEBUG_BOX];
+
+    // Cylinder of radius 1 along z from -1 to 1: both caps and 4 sides.
+    shapes->first[DEBUG_CYLINDER] = *n;
+    debug_unit_circle(verts, n, 0, 1, bottom);
+    debug_unit_circle(verts, n, 0, 1, top);
+    for (uint32_t i = 0; i < 4; ++i) {
+        float x = i == 0 ? 1.f : i == 2 ? -1.f : 0.f;
+        float y = i == 1 ? 1.f : i == 3 ? -1.f : 0.f;
+
+        for (uint32_t end = 0; end < 2; ++end) {
+            float *p = verts[(*n)++];
+
+            p[0] = x;
+            p[1] = y;
+            p[2] = end ? 1.f : -1.f;
+        }
+    }
+    shapes->count[DEBUG_CYLINDER] = *n - shapes->first[DEBUG_CYLINDER];
 }
 
-void debug_renderer_drawsphere(DebugRenderer *debug, vec3 c0, float s, uint16_t iter)
+//  Builds the meshes and uploads them through `staging`; they are there
+//  for frames submitted after its next flush.
+void debug_shapes_init(Renderer *renderer, DebugShapes *shapes, StagingRing *staging)
 {
-    float astep = 2.f * M_PI / iter;
-    float s0, s1;
-    vec3 p0, p1;
+    vec3 verts[2 * (5 * DEBUG_SHAPE_SEGMENTS + 16)] = {};
+    uint32_t n = 0;
+
+    debug_unit_meshes(shapes, verts, &n);
+    assert(n <= sizeof(verts) / sizeof(vec3));
+
+    create_static_vertex_buffer(renderer, staging, &shapes->mesh, verts, n * sizeof(vec3));
 
-    for (size_t i = 0; i < iter; i++) {
-        s0 = astep * i;
-        s1 = astep * (i + 1);
+    VkVertexInputBindingDescription bindings[2] = {};
+    bindings[0].binding = 0;
+    bindings[0].stride = sizeof(vec3);
+    bindings[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+    bindings[1].binding = 1;
+    bindings[1].stride = sizeof(DebugInstance);
+    bindings[1].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
 
-        vec3_add(p0, c0, vec3{cosf(s0) * s, sinf(s0) * s, 0});
-        vec3_add(p1, c0, vec3{cosf(s1) * s, sinf(s1) * s, 0});
-        debug_renderer_drawline(debug, p0, p1);
+    VkVertexInputAttributeDescription attributes[5] = {};
+    attributes[0].binding = 0;
+    attributes[0].location = 0;
+    attributes[0].format = VK_FORMAT_R32G32B32_SFLOAT;
+    attributes[0].offset = 0;
+
+    for (uint32_t i = 1; i < 5; ++i) {
+        attributes[i].binding = 1;
+        attributes[i].location = i;
+        attributes[i].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+        attributes[i].offset = (i - 1) * sizeof(vec4);
     }
 
-    for (size_t i = 0; i < iter; i++) {
-        s0 = astep * i;
-        s1 = astep * (i + 1);
+    VkPipelineVertexInputStateCreateInfo vertex_input = {};
+    vertex_input.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    vertex_input.vertexBindingDescriptionCount = 2;
+    vertex_input.vertexAttributeDescriptionCount = 5;
+    vertex_input.pVertexBindingDescriptions = bindings;
+    vertex_input.pVertexAttributeDescriptions = attributes;
+
+    create_material(renderer, &shapes->material, "../data/shaders/debug_vert.spv", &vertex_input);
 
-        vec3_add(p0, c0, vec3{cosf(s0) * s, 0, sinf(s0) * s});
-        vec3_add(p1, c0, vec3{cosf(s1) * s, 0, sinf(s1) * s});
-        debug_renderer_drawline(debug, p0, p1);
+    for (uint32_t i = 0; i < DEBUG_SHAPE_COUNT; ++i) {
+        shapes->instances[i] = nullptr;
+        shapes->instance_count[i] = 0;
+        shapes->instance_capacity[i] = 0;
     }
+}
 
-    for (size_t i = 0; i < iter; i++) {
-        s0 = astep * i;
-        s1 = astep * (i + 1);
+//  Adds an instance whose unit mesh axes map to x, y and z, centred on t.
+static void debug_shapes_add(DebugShapes *shapes, DebugShape shape, const vec3 x, const vec3 y, const vec3 z, const vec3 t, const vec3 color)
+{
+    if (shapes->instance_count[shape] == shapes->instance_capacity[shape]) {
+        shapes->instance_capacity[shape] = shapes->instance_capacity[shape] ? 2 * shapes->instance_capacity[shape] : 1024;
+        shapes->instances[shape] = (DebugInstance *)realloc(shapes->instances[shape], sizeof(DebugInstance) * shapes->instance_capacity[shape]);
+    }
 
-        vec3_add(p0, c0, vec3{0, cosf(s0) * s, sinf(s0) * s});
-        vec3_add(p1, c0, vec3{0, cosf(s1) * s, sinf(s1) * s});
+    DebugInstance *instance = &shapes->instances[shape][shapes->instance_count[shape]++];
 
-        debug_renderer_drawline(debug, p0, p1);
+    for (uint32_t r = 0; r < 3; ++r) {
+        instance->rows[r][0] = x[r];
+        instance->rows[r][1] = y[r];
+        instance->rows[r][2] = z[r];
+        instance->rows[r][3] = t[r];
     }
+
+    memcpy(instance->color, color, sizeof(vec3));
+    instance->color[3] = 1.f;
+}
+
+void debug_shapes_sphere(DebugShapes *shapes, const vec3 center, float radius, const vec3 color)
+{
+    vec3 x = {radius, 0, 0};
+    vec3 y = {0, radius, 0};
+    vec3 z = {0, 0, radius};
+
+    debug_shapes_add(shapes, DEBUG_SPHERE, x, y, z, center, color);
 }
 
-void debug_renderer_flush(Renderer *renderer, DebugRenderer *debug, uint32_t *count)
+void debug_shapes_box(DebugShapes *shapes, const vec3 center, const vec3 half, const vec3 color)
 {
-    assert(debug->count);
-    
-    *count = debug->count;
-    fill_vertex_buffer(renderer, &debug->buffer, (void *)debug->verts, debug->count * sizeof(vec3));
-    debug->count = 0;
+    vec3 x = {half[0], 0, 0};
+    vec3 y = {0, half[1], 0};
+    vec3 z = {0, 0, half[2]};
+
+    debug_shapes_add(shapes, DEBUG_BOX, x, y, z, center, color);
+}
+
+//  Cylinder between the centres of its caps, a and b.
+void debug_shapes_cylinder(DebugShapes *shapes, const vec3 a, const vec3 b, float radius, const vec3 color)
+{
+    vec3 center, z, dir, helper, x, y;
+
+    vec3_add(center, a, b);
+    vec3_scale(center, center, .5f);
+    vec3_sub(z, b, a);
+    vec3_scale(z, z, .5f);
+
+    float length = vec3_len(z);
+    if (length == 0.f) {
+        return;
+    }
+
+    vec3_scale(dir, z, 1.f / length);
+
+    helper[0] = fabsf(dir[0]) < .9f ? 1.f : 0.f;
+    helper[1] = fabsf(dir[0]) < .9f ? 0.f : 1.f;
+    helper[2] = 0.f;
+
+    vec3_mul_cross(x, dir, helper);
+    vec3_norm(x, x);
+    vec3_mul_cross(y, dir, x);
+
+    vec3_scale(x, x, radius);
+    vec3_scale(y, y, radius);
+
+    debug_shapes_add(shapes, DEBUG_CYLINDER, x, y, z, center, color);
+}
+
+//  Copies this frame's instances into `ring` and records one instanced
+//  draw per shape, or more when a shape has more instances than a ring
+//  region holds. Binds its own pipeline. Returns the number of draws.
+uint32_t debug_shapes_flush(Renderer *renderer, DebugShapes *shapes, FrameRing *ring, VkCommandBuffer cmdbuffer, mat4x4 mvp)
+{
+    uint32_t total = 0;
+    for (uint32_t i = 0; i < DEBUG_SHAPE_COUNT; ++i) {
+        total += shapes->instance_count[i];
+    }
+
+    if (!total) {
+        return 0;
+    }
+
+    VkDeviceSize mesh_offset = 0;
+    uint32_t per_draw = (uint32_t)(ring->region_size / sizeof(DebugInstance));
+    uint32_t draws = 0;
+
+    vkCmdBindPipeline(cmdbuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shapes->material.pipeline);
+    vkCmdPushConstants(cmdbuffer, shapes->material.layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(mat4x4), mvp);
+    vkCmdBindVertexBuffers(cmdbuffer, 0, 1, &shapes->mesh.buffer, &mesh_offset);
+
+    for (uint32_t i = 0; i < DEBUG_SHAPE_COUNT; ++i) {
+        for (uint32_t first = 0; first < shapes->instance_count[i]; first += per_draw) {
+            uint32_t count = shapes->instance_count[i] - first < per_draw ? shapes->instance_count[i] - first : per_draw;
+            FrameRange range;
+
+            if (!frame_ring_alloc(renderer, ring, count * sizeof(DebugInstance), sizeof(vec4), &range)) {
+                break;
+            }
+
+            memcpy(range.data, &shapes->instances[i][first], count * sizeof(DebugInstance));
+
+            vkCmdBindVertexBuffers(cmdbuffer, 1, 1, &range.buffer, &range.offset);
+            vkCmdDraw(cmdbuffer, shapes->count[i], count, shapes->first[i], 0);
+            draws++;
+        }
+
+        shapes->instance_count[i] = 0;
+    }
+
+    return draws;
 }
 
 #endif
\ No newline at end of file
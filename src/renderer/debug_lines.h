@@ -0,0 +1,86 @@
+#ifndef RENDERER_DEBUG_LINES_H
+#define RENDERER_DEBUG_LINES_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <linmath.h>
+
+//  The CPU side of the debug line renderer, apart from debug.h so it builds
+//  without Vulkan.
+
+//  Lines are collected on the CPU in a chain of fixed size chunks, so
+//  drawing never moves what was already drawn and never runs off the end.
+//  Chunks are kept from frame to frame; once the chain is as long as the
+//  busiest frame needed (chunk_count is that high-water mark), drawing
+//  allocates nothing.
+struct DebugRenderer {
+    vec3 **chunks;
+    uint32_t chunk_count;
+    uint32_t chunk;
+    vec3 *cursor;
+    vec3 *end;
+};
+
+//  In vertices. Even, so a line never straddles two chunks.
+static const uint32_t DEBUG_CHUNK_SIZE = 1024 * 64;
+
+static void debug_renderer_next_chunk(DebugRenderer *debug)
+{
+    if (debug->chunk + 1 == debug->chunk_count) {
+        debug->chunks = (vec3 **)realloc(debug->chunks, sizeof(vec3 *) * ++debug->chunk_count);
+        debug->chunks[debug->chunk_count - 1] = new vec3[DEBUG_CHUNK_SIZE];
+    }
+
+    debug->chunk++;
+    debug->cursor = debug->chunks[debug->chunk];
+    debug->end = debug->cursor + DEBUG_CHUNK_SIZE;
+}
+
+static void debug_renderer_reset(DebugRenderer *debug)
+{
+    debug->chunk = 0;
+    debug->cursor = debug->chunks[0];
+    debug->end = debug->cursor + DEBUG_CHUNK_SIZE;
+}
+
+void debug_renderer_init_chunks(DebugRenderer *debug)
+{
+    debug->chunks = (vec3 **)malloc(sizeof(vec3 *));
+    debug->chunks[0] = new vec3[DEBUG_CHUNK_SIZE];
+    debug->chunk_count = 1;
+    debug_renderer_reset(debug);
+}
+
+void debug_renderer_cleanup(DebugRenderer *debug)
+{
+    for (uint32_t i = 0; i < debug->chunk_count; ++i) {
+        delete[] debug->chunks[i];
+    }
+
+    free(debug->chunks);
+}
+
+//  Vertices drawn since the last flush.
+size_t debug_renderer_count(DebugRenderer *debug)
+{
+    return (size_t)debug->chunk * DEBUG_CHUNK_SIZE + (debug->cursor - debug->chunks[debug->chunk]);
+}
+
+//  Vertices in chunk `i` of the ones drawn since the last flush.
+uint32_t debug_renderer_chunk_size(DebugRenderer *debug, uint32_t i)
+{
+    return i < debug->chunk ? DEBUG_CHUNK_SIZE : (uint32_t)(debug->cursor - debug->chunks[i]);
+}
+
+void debug_renderer_drawline(DebugRenderer *debug, vec3 a, vec3 b)
+{
+    if (debug->cursor == debug->end) {
+        debug_renderer_next_chunk(debug);
+    }
+
+    memcpy(debug->cursor[0], a, sizeof(vec3));
+    memcpy(debug->cursor[1], b, sizeof(vec3));
+    debug->cursor += 2;
+}
+
+#endif
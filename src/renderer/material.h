@@ -109,7 +109,9 @@ void material_update_descriptors(Renderer *renderer, Material *material, Uniform
     }
 }
 
-void create_material(Renderer *renderer, Material *material)
+//  Line list pipeline. Without a vertex input state, vertices are a single
+//  vec3 position.
+void create_material(Renderer *renderer, Material *material, const char *vert_path = "../data/shaders/lines_vert.spv", const VkPipelineVertexInputStateCreateInfo *vertex_input = nullptr)
 {
     VkResult result;
 
@@ -119,7 +121,7 @@ void create_material(Renderer *renderer, Material *material)
     size_t vert_size,
            frag_size;
 
-    read_shader("../data/shaders/lines_vert.spv", &vert_source, &vert_size);
+    read_shader(vert_path, &vert_source, &vert_size);
     read_shader("../data/shaders/tri_frag.spv", &frag_source, &frag_size);
 
     fmt::print("vert source size: {}\n", vert_size);
@@ -166,6 +168,10 @@ void create_material(Renderer *renderer, Material *material)
     vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
     vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions;
 
+    if (vertex_input) {
+        vertexInputInfo = *vertex_input;
+    }
+
     VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
     inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
     inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_LINE_LIST;
@@ -9,6 +9,7 @@
 
 #include "core.h"
 #include "buffers.h"
+#include "staging.h"
 #include "material.h"
 #include "camera.h"
 
@@ -318,7 +319,10 @@ void renderer_init(Renderer *renderer)
     fmt::print("graphics queue: {}\n", indicies.graphics);
     fmt::print("present queue: {}\n", indicies.present);
 
+    renderer->graphics_family = indicies.graphics;
+
     create_logical(renderer, &indicies);
+    allocator_init(&renderer->allocator, renderer->physical_device, renderer->device);
     create_swapchain(renderer, &indicies);
     create_imageviews(renderer);
     create_renderpass(renderer);
@@ -0,0 +1,284 @@
+#ifndef RENDERER_STAGING_H
+#define RENDERER_STAGING_H
+
+#include <vulkan/vulkan.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core.h"
+#include "buffers.h"
+
+//  Uploads into device local buffers through one persistently mapped,
+//  host visible ring. Data is copied into the ring and a copy out of it is
+//  recorded into the open batch's command buffer; consecutive copies into
+//  the same buffer go out as one vkCmdCopyBuffer. staging_flush submits the
+//  batch on the graphics queue with its own fence, ahead of any frame that
+//  reads the buffers.
+//
+//  Ring space is handed back as the fences of older batches signal, in
+//  submission order. Only when the ring is full does an upload wait, and
+//  then on the oldest batch's fence alone rather than the whole queue.
+
+const VkDeviceSize STAGING_SIZE = 8 * 1024 * 1024;
+const uint32_t STAGING_BATCHES = 4;
+
+//  `end` is the ring head once the batch's data was written, so the ring
+//  tail can move up to it when the batch completes.
+struct StagingBatch {
+    VkCommandBuffer cmdbuffer;
+    VkFence fence;
+    VkDeviceSize end;
+    bool open;
+    bool pending;
+};
+
+//  `head` and `tail` only ever grow; the ring offset is them modulo size.
+struct StagingRing {
+    VkBuffer buffer;
+    Allocation allocation;
+    VkDeviceSize size;
+    VkDeviceSize head;
+    VkDeviceSize tail;
+
+    VkCommandPool pool;
+    StagingBatch batches[STAGING_BATCHES];
+    uint32_t current;
+    uint32_t oldest;
+
+    VkBuffer region_dst;
+    VkBufferCopy *regions;
+    uint32_t region_count;
+    uint32_t region_capacity;
+};
+
+void staging_init(Renderer *renderer, StagingRing *ring, VkDeviceSize size = STAGING_SIZE)
+{
+    VkResult result;
+
+    create_buffer(renderer, &ring->buffer, &ring->allocation, size,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+    ring->size = size;
+    ring->head = 0;
+    ring->tail = 0;
+
+    VkCommandPoolCreateInfo pool_info = {};
+    pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    pool_info.queueFamilyIndex = renderer->graphics_family;
+    pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+    result = vkCreateCommandPool(renderer->device, &pool_info, nullptr, &ring->pool);
+    check_vulkan_result(result, "Failed to create staging command pool.");
+
+    VkCommandBuffer cmdbuffers[STAGING_BATCHES];
+
+    VkCommandBufferAllocateInfo alloc_info = {};
+    alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    alloc_info.commandPool = ring->pool;
+    alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    alloc_info.commandBufferCount = STAGING_BATCHES;
+
+    result = vkAllocateCommandBuffers(renderer->device, &alloc_info, cmdbuffers);
+    check_vulkan_result(result, "Failed to allocate staging command buffers.");
+
+    for (uint32_t i = 0; i < STAGING_BATCHES; ++i) {
+        VkFenceCreateInfo fence_info = {};
+        fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+        result = vkCreateFence(renderer->device, &fence_info, nullptr, &ring->batches[i].fence);
+        check_vulkan_result(result, "Failed to create staging fence.");
+
+        ring->batches[i].cmdbuffer = cmdbuffers[i];
+        ring->batches[i].end = 0;
+        ring->batches[i].open = false;
+        ring->batches[i].pending = false;
+    }
+
+    ring->current = 0;
+    ring->oldest = 0;
+
+    ring->region_dst = VK_NULL_HANDLE;
+    ring->regions = nullptr;
+    ring->region_count = 0;
+    ring->region_capacity = 0;
+}
+
+//  Frees the ring space of the oldest submitted batch, waiting for it to
+//  complete if `wait` is set. Returns false if there was none or it is
+//  still running.
+static bool staging_retire(Renderer *renderer, StagingRing *ring, bool wait)
+{
+    StagingBatch *batch = &ring->batches[ring->oldest];
+
+    if (!batch->pending) {
+        return false;
+    }
+
+    if (wait) {
+        vkWaitForFences(renderer->device, 1, &batch->fence, VK_TRUE, UINT64_MAX);
+    } else if (vkGetFenceStatus(renderer->device, batch->fence) != VK_SUCCESS) {
+        return false;
+    }
+
+    vkResetFences(renderer->device, 1, &batch->fence);
+    batch->pending = false;
+    ring->tail = batch->end;
+    ring->oldest = (ring->oldest + 1) % STAGING_BATCHES;
+
+    return true;
+}
+
+static void staging_emit_regions(StagingRing *ring)
+{
+    if (ring->region_count) {
+        vkCmdCopyBuffer(ring->batches[ring->current].cmdbuffer, ring->buffer, ring->region_dst, ring->region_count, ring->regions);
+        ring->region_count = 0;
+    }
+}
+
+//  Submits the copies recorded since the last flush. Buffers they write
+//  can be drawn from by anything submitted afterwards.
+void staging_flush(Renderer *renderer, StagingRing *ring)
+{
+    StagingBatch *batch = &ring->batches[ring->current];
+
+    if (!batch->open) {
+        return;
+    }
+
+    staging_emit_regions(ring);
+
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+
+    vkCmdPipelineBarrier(batch->cmdbuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0,
+        1, &barrier, 0, nullptr, 0, nullptr);
+
+    vkEndCommandBuffer(batch->cmdbuffer);
+
+    VkSubmitInfo submit_info = {};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &batch->cmdbuffer;
+
+    VkResult result = vkQueueSubmit(renderer->graphics_queue, 1, &submit_info, batch->fence);
+    check_vulkan_result(result, "Failed to submit staging batch.");
+
+    batch->end = ring->head;
+    batch->open = false;
+    batch->pending = true;
+    ring->current = (ring->current + 1) % STAGING_BATCHES;
+}
+
+//  Ring offset for `size` contiguous bytes, retiring finished batches and,
+//  if that isn't enough, submitting and waiting on older ones.
+static VkDeviceSize staging_reserve(Renderer *renderer, StagingRing *ring, VkDeviceSize size)
+{
+    while (staging_retire(renderer, ring, false)) {}
+
+    for (;;) {
+        if (ring->tail == ring->head && !ring->batches[ring->current].open) {
+            ring->head = ring->tail = 0;
+        }
+
+        VkDeviceSize start = ring->head;
+        VkDeviceSize offset = start % ring->size;
+
+        // Data never wraps around the end; skip to the start instead.
+        if (offset + size > ring->size) {
+            start += ring->size - offset;
+        }
+
+        if (start + size - ring->tail <= ring->size) {
+            ring->head = start + size;
+            return start % ring->size;
+        }
+
+        if (!staging_retire(renderer, ring, true)) {
+            staging_flush(renderer, ring);
+        }
+    }
+}
+
+static VkCommandBuffer staging_batch(Renderer *renderer, StagingRing *ring)
+{
+    StagingBatch *batch = &ring->batches[ring->current];
+
+    if (!batch->open) {
+        // All batches in flight: the oldest one is the one to reuse.
+        if (batch->pending) {
+            staging_retire(renderer, ring, true);
+        }
+
+        VkCommandBufferBeginInfo begin_info = {};
+        begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+        vkBeginCommandBuffer(batch->cmdbuffer, &begin_info);
+        batch->open = true;
+    }
+
+    return batch->cmdbuffer;
+}
+
+//  Queues `size` bytes of `data` for `dst` at `dst_offset`. The data is
+//  copied right away; the transfer happens at the next staging_flush.
+void staging_upload(Renderer *renderer, StagingRing *ring, VkBuffer dst, VkDeviceSize dst_offset, const void *data, VkDeviceSize size)
+{
+    const char *src = (const char *)data;
+
+    while (size) {
+        VkDeviceSize chunk = size < ring->size ? size : ring->size;
+        VkDeviceSize offset = staging_reserve(renderer, ring, chunk);
+
+        memcpy((char *)ring->allocation.mapped + offset, src, chunk);
+
+        staging_batch(renderer, ring);
+
+        if (ring->region_dst != dst) {
+            staging_emit_regions(ring);
+            ring->region_dst = dst;
+        }
+
+        if (ring->region_count == ring->region_capacity) {
+            ring->region_capacity = ring->region_capacity ? 2 * ring->region_capacity : 16;
+            ring->regions = (VkBufferCopy *)realloc(ring->regions, ring->region_capacity * sizeof(VkBufferCopy));
+        }
+
+        ring->regions[ring->region_count++] = {offset, dst_offset, chunk};
+
+        src += chunk;
+        dst_offset += chunk;
+        size -= chunk;
+    }
+}
+
+//  Submits what is left, waits for every batch and frees the ring.
+void staging_cleanup(Renderer *renderer, StagingRing *ring)
+{
+    staging_flush(renderer, ring);
+
+    while (staging_retire(renderer, ring, true)) {}
+
+    for (uint32_t i = 0; i < STAGING_BATCHES; ++i) {
+        vkDestroyFence(renderer->device, ring->batches[i].fence, nullptr);
+    }
+
+    vkDestroyCommandPool(renderer->device, ring->pool, nullptr);
+    destroy_buffer(renderer, ring->buffer, &ring->allocation);
+    free(ring->regions);
+}
+
+//  Vertex buffer in device local memory, filled through the staging ring.
+//  Its contents are there for frames submitted after the next flush.
+void create_static_vertex_buffer(Renderer *renderer, StagingRing *ring, VertexBuffer *buffer, const void *data, VkDeviceSize size)
+{
+    create_buffer(renderer, &buffer->buffer, &buffer->allocation, size,
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    staging_upload(renderer, ring, buffer->buffer, 0, data, size);
+}
+
+#endif
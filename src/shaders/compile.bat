@@ -1,4 +1,5 @@
 C:\VulkanSDK\1.2.141.2\Bin32\glslc.exe tri.vert -o ../../data/shaders/tri_vert.spv
 C:\VulkanSDK\1.2.141.2\Bin32\glslc.exe tri.frag -o ../../data/shaders/tri_frag.spv
 C:\VulkanSDK\1.2.141.2\Bin32\glslc.exe lines.vert -o ../../data/shaders/lines_vert.spv
+C:\VulkanSDK\1.2.141.2\Bin32\glslc.exe debug.vert -o ../../data/shaders/debug_vert.spv
 pause
\ No newline at end of file
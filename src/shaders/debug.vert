@@ -0,0 +1,23 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec4 inRow0;
+layout(location = 2) in vec4 inRow1;
+layout(location = 3) in vec4 inRow2;
+layout(location = 4) in vec4 inColor;
+
+layout(location = 0) out vec3 fragColor;
+
+layout( push_constant ) uniform ModelViewProjection {
+    mat4 mvp;
+} mvp;
+
+//  Unit mesh vertex placed by its instance's affine transform, given as
+//  the top three rows.
+void main() {
+    vec4 position = vec4(inPosition, 1.0);
+
+    gl_Position = mvp.mvp * vec4(dot(inRow0, position), dot(inRow1, position), dot(inRow2, position), 1.0);
+    fragColor = inColor.rgb;
+}
@@ -0,0 +1,18 @@
+@echo off
+
+call "C:\Program Files (x86)\Microsoft Visual Studio\2017\Community\VC\Auxiliary\Build\vcvarsall.bat" x64
+
+mkdir build
+pushd build
+
+SET ARGS=/MD /Zi /W4 /EHsc
+
+SET LIBS=vulkan-1.lib fmt.lib
+SET LIBPATHS=/LIBPATH:C:\VulkanSDK\1.2.141.2\Lib /LIBPATH:..\thirdparty\fmt\lib
+SET INCLUDES=/I C:\VulkanSDK\1.2.141.2\Include /I ..\thirdparty\fmt\include
+
+cl /DDEBUG %ARGS% %INCLUDES% ..\src\allocator_test.cpp /link %LIBPATHS% %LIBS%
+
+allocator_test.exe
+
+popd